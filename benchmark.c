@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <strings.h>
 #include <sched.h>
 #include <time.h>
@@ -26,14 +27,14 @@
 #include <sys/mman.h>
 #include <sys/resource.h>
 
+#include "benchmark.h"
+#include "cpufeature.h"
+#include "trace.h"
+
 static struct rusage susage, eusage;
-#define GIGABYTES(x)    ((long long)(x) << 30)
-#define MEGABYTES(x)    ((long long)(x) << 20)
-#define KILOBYTES(x)    ((long long)(x) << 10)
-static void die(const char *str) __attribute__((__noreturn__));
 
 /* Exit program */
-static void die(const char *str)
+void die(const char *str)
 {
 	perror(str);
 	exit(1);
@@ -72,15 +73,17 @@ static time_t timediff(struct timeval *start)
 		stop.tv_usec - start->tv_usec;
 }
 
-/**
- * Invalidate the cache line that contains the linear address specified with
- * @p from all levels of the processor cache hierarchy (data and instruction)
- *
- * Please NOTE: The data is not written-back but invalidated.
- */
-static inline void clflush(volatile void *p)
+int cmp_unsigned(const void *a, const void *b)
 {
-	asm volatile ("clflush (%0)" :: "r"(p));
+	unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+unsigned median(unsigned *v, int n)
+{
+	qsort(v, n, sizeof(*v), cmp_unsigned);
+	return v[n / 2];
 }
 
 /**
@@ -95,7 +98,7 @@ static inline void clflush(volatile void *p)
  * program so there should not be lot of context-switches. If we see lot of
  * context switches the something is not correct.)
  */
-static void benchmark_prologue(struct timeval *start, uint8_t *buf, size_t size)
+void benchmark_prologue(struct timeval *start, uint8_t *buf, size_t size)
 {
 	loff_t i;
 	const size_t page_size = getpagesize();
@@ -129,7 +132,7 @@ static void benchmark_prologue(struct timeval *start, uint8_t *buf, size_t size)
  * End timer and get hard and soft page faults during the test run. If results
  * show higher values for page faults, then results will not be very accurate.
  */
-static void benchmark_epilogue(struct timeval *start, size_t step)
+void benchmark_epilogue(struct timeval *start, size_t step)
 {
 	time_t diff;
 	char *prefix;
@@ -161,8 +164,11 @@ static void bench(uint32_t *buf, size_t length, int step)
 	const unsigned char shift = ffs(sizeof(uint32_t)) - 1;
 	length >>= shift;
 
-	for ( i = 0; i < length; i+= step)
+	for ( i = 0; i < length; i+= step) {
+		TRACE_LOAD(&buf[i]);
+		TRACE_STORE(&buf[i]);
 		buf[i] *= 3;
+	}
 }
 
 static void bench1(uint32_t *buf, size_t length, int limit)
@@ -170,15 +176,22 @@ static void bench1(uint32_t *buf, size_t length, int limit)
 	int i;
 	size_t lengthMod = length - 1;
 
-	for (i = 0; i < limit; i++)
+	for (i = 0; i < limit; i++) {
+		TRACE_LOAD(&buf[(i * 16) & lengthMod]);
+		TRACE_STORE(&buf[(i * 16) & lengthMod]);
 		buf[(i * 16) & lengthMod]++;
+	}
 }
 
 static void bench2(uint32_t *buf, int count)
 {
 	int i;
 	for (i = 0; i < count; i++) {
+		TRACE_LOAD(&buf[0]);
+		TRACE_STORE(&buf[0]);
 		buf[0]++;
+		TRACE_LOAD(&buf[0]);
+		TRACE_STORE(&buf[0]);
 		buf[0]++;
 	}
 }
@@ -187,37 +200,28 @@ static void bench3(uint32_t *buf, int count)
 {
 	int i;
 	for (i = 0; i < count; i++) {
+		TRACE_LOAD(&buf[0]);
+		TRACE_STORE(&buf[0]);
 		buf[0]++;
+		TRACE_LOAD(&buf[1]);
+		TRACE_STORE(&buf[1]);
 		buf[1]++;
 	}
 }
 #pragma GCC pop_options
 
-int main(void)
+static const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+static const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+/* Example 3 buffer placement, see example_sizes(). */
+static bool sizes_huge;
+static size_t sizes_offset;
+
+static void example_lines(void)
 {
 	uint32_t *buf;
 	size_t size, step;
 	struct timeval start;
-	cpu_set_t my_set;
-	struct sched_param param;
-	const int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
-	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-
-	/*
- 	 * Set CPU affinity so that this process is always scheduled in the same
- 	 * cpu core. Scheduling in speparate cores will not account for L1 hits
-	 * which is not shared between the chores.
- 	 */ 
-	CPU_ZERO(&my_set);
-	CPU_SET(0, &my_set);
-	sched_setaffinity(0, sizeof(cpu_set_t), &my_set);
-	/*
-	 * Set maximum priority with real time FIFO policy so that the process
-	 * does not get preempted too often and gets more CPU usage.
-	 */
-	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
-	if (sched_setscheduler(0, SCHED_FIFO, &param))
-		die("sched_setscheduler()");
 
 	fprintf(stdout, "\nExample 2: Impact of cache lines. 1\n");
 
@@ -232,23 +236,57 @@ int main(void)
 	}
 	if (munmap(buf, size) == -1)
 		die("munmap()");
+}
+
+/*
+ * One mapping serves the whole sweep, each size runs on its head, so pages
+ * are faulted in by the first sizes only and the largest sizes are not
+ * dominated by mmap/munmap. Every size starts at the same offset of the
+ * mapping, and so at the same page colour: sizes_offset pages past the
+ * start, which is 2 MB aligned when sizes_huge asks for transparent huge
+ * pages.
+ */
+static void example_sizes(void)
+{
+	uint8_t *map, *head;
+	uint32_t *buf;
+	size_t size, step, map_size;
+	size_t off = sizes_offset * getpagesize();
+	struct timeval start;
 
 	fprintf(stdout, "\nExample 3: L1 and L2 cache sizes\n");
 
+	map_size = GIGABYTES(1) + off + (sizes_huge ? MEGABYTES(2) : 0);
+	map = mmap(NULL, map_size, prot, flags, -1, 0);
+	if (map == MAP_FAILED)
+		die("mmap()");
+	head = map;
+	if (sizes_huge) {
+		head = (uint8_t *)(((uintptr_t)map + MEGABYTES(2) - 1) &
+				   ~(MEGABYTES(2) - 1));
+		if (madvise(head, map_size - (head - map), MADV_HUGEPAGE))
+			die("madvise()");
+	}
+	buf = (uint32_t *)(head + off);
+
 	for (step = KILOBYTES(1); step <= GIGABYTES(1); step <<= 1) {
 		size_t length;
 
 		length = step >> (ffs(sizeof(uint32_t)) - 1);
 		size = length * sizeof(uint32_t);
-		buf = (uint32_t *)mmap(NULL, size, prot, flags, -1, 0);
-		if (buf == MAP_FAILED)
-			die("mmap()");
 		benchmark_prologue(&start, (uint8_t *)buf, size);
 		bench1(buf, length, MEGABYTES(64));
 		benchmark_epilogue(&start, step);
-		if (munmap(buf, size) == -1)
-			die("munmap()");
 	}
+	if (munmap(map, map_size) == -1)
+		die("munmap()");
+}
+
+static void example_ilp(void)
+{
+	uint32_t *buf;
+	size_t size;
+	struct timeval start;
 
 	fprintf(stdout, "\nExample 4: Instruction-level parallelism\n");
 
@@ -264,5 +302,192 @@ int main(void)
 	benchmark_epilogue(&start, 2);
 	if (munmap(buf, size) == -1)
 		die("munmap()");
+}
+
+/*
+ * Registry of the benchmarks. When none is named on the command line the
+ * ones not marked on_demand are run, in this order.
+ */
+static const struct benchmark benchmarks[] = {
+	{ "lines", "Example 2: Impact of cache lines", example_lines,
+	  false, true },
+	{ "sizes", "Example 3: L1 and L2 cache sizes", example_sizes,
+	  false, true },
+	{ "ilp", "Example 4: Instruction-level parallelism", example_ilp,
+	  false, true },
+	{ "replacement", "Replacement policy inference per cache level",
+	  replacement_benchmark, true },
+	{ "inclusion", "Inclusive/exclusive/NINE behaviour per cache level",
+	  inclusion_benchmark, true },
+	{ "linesize", "Line size, prefetch pairing, destructive interference",
+	  linesize_benchmark, true },
+	{ "dram", "DRAM row hits/conflicts and bank address functions",
+	  dram_benchmark, true },
+	{ "memops", "memcpy/memset strategies and their crossover sizes",
+	  memops_benchmark, true, true },
+	{ "libc", "libc memcpy/memset rates, to compare GLIBC_TUNABLES",
+	  libc_benchmark, true, true },
+	{ "tunables", "Measured GLIBC_TUNABLES for this host, and their effect",
+	  tunables_benchmark, true, true },
+	{ "prefault", "Page fault cost and prefault strategies, 1 MB and up",
+	  prefault_benchmark, true },
+	{ "kernel", "Example 3 in user space vs in the read-cr0 module",
+	  kbench_benchmark, true },
+	{ "pat", "WB/WC/UC/WT memory bandwidth and latency (/dev/memtype)",
+	  pat_benchmark, true },
+	{ "flush", "wbinvd by dirty footprint, clflush/clflushopt/clwb ranges",
+	  flush_benchmark, true },
+	{ "occupancy", "LLC share taken by co-runners over time, prime+probe",
+	  occupancy_benchmark, true },
+	{ "tune", "Recommended runtime settings, as a config file",
+	  tune_benchmark, true },
+	{ "smt", "SMT siblings vs separate cores, per kernel kind",
+	  smt_benchmark, true },
+	{ "gather", "AVX2/AVX-512 gathers vs scalar loads by locality and size",
+	  gather_benchmark, true, true },
+	{ "streams", "Bandwidth of 1 to 64 interleaved sequential streams",
+	  streams_benchmark, true, true },
+	{ "fences", "Cost of fences, locked ops, cpuid and serialize",
+	  fences_benchmark, true },
+	{ NULL, NULL, NULL }
+};
+
+static void usage(const char *prog)
+{
+	const struct benchmark *b;
+
+	fprintf(stderr, "Usage: %s [-lH] [-o PAGES] [-t TRACE] [-I ISA] "
+		"[NAME]...\n"
+		"  -l  list the benchmarks\n"
+		"  -H  back the Example 3 buffer with transparent huge pages\n"
+		"  -o  start the Example 3 buffer PAGES pages into its mapping\n"
+		"  -t  record the load/store addresses of the instrumented "
+		"kernels\n      (lines, sizes, ilp, memops, libc, tunables, "
+		"gather, streams) to TRACE\n"
+		"  -I  run vector kernels at most at ISA: scalar, sse4.2, "
+		"avx2, avx512\n"
+		"\nBenchmarks:\n", prog);
+	for (b = benchmarks; b->name; b++)
+		fprintf(stderr, "  %-12s %s\n", b->name, b->desc);
+	exit(2);
+}
+
+/*
+ * Annotate the results with the cache control state of the cpu we run on,
+ * when the read-cr0 module is loaded.
+ */
+static void print_cpu_ctrl(int cpu)
+{
+	char line[512], prefix[16];
+	FILE *fp;
+
+	if (!(fp = fopen("/proc/cache_ctrl", "r")))
+		return;
+	snprintf(prefix, sizeof(prefix), "cpu%d ", cpu);
+	while (fgets(line, sizeof(line), fp))
+		if (!strncmp(line, prefix, strlen(prefix)))
+			fprintf(stdout, "# %s", line);
+	fclose(fp);
+}
+
+static const struct benchmark *find_benchmark(const char *name)
+{
+	const struct benchmark *b;
+
+	for (b = benchmarks; b->name; b++)
+		if (!strcmp(b->name, name))
+			return b;
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const struct benchmark *b;
+	const char *trace_path = NULL;
+	cpu_set_t my_set;
+	struct sched_param param;
+	int i, opt, isa;
+
+	while ((opt = getopt(argc, argv, "lHo:t:I:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			for (b = benchmarks; b->name; b++)
+				fprintf(stdout, "%-12s %s\n", b->name, b->desc);
+			return 0;
+		case 'H':
+			sizes_huge = true;
+			break;
+		case 'o':
+			sizes_offset = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			trace_path = optarg;
+			break;
+		case 'I':
+			if ((isa = isa_parse(optarg)) < 0)
+				usage(argv[0]);
+			isa_force(isa);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	for (i = optind; i < argc; i++) {
+		if (!(b = find_benchmark(argv[i])))
+			usage(argv[0]);
+		if (trace_path && !b->traced)
+			fprintf(stderr, "%s is not instrumented, it adds nothing "
+				"to the trace\n", b->name);
+	}
+#ifndef CONFIG_TRACE
+	if (trace_path) {
+		fprintf(stderr, "Kernels are not instrumented in this build, "
+			"use benchmark-trace\n");
+		return 2;
+	}
+#endif
+
+	/*
+ 	 * Set CPU affinity so that this process is always scheduled in the same
+ 	 * cpu core. Scheduling in speparate cores will not account for L1 hits
+	 * which is not shared between the chores.
+ 	 */ 
+	CPU_ZERO(&my_set);
+	CPU_SET(0, &my_set);
+	sched_setaffinity(0, sizeof(cpu_set_t), &my_set);
+	/*
+	 * Set maximum priority with real time FIFO policy so that the process
+	 * does not get preempted too often and gets more CPU usage.
+	 */
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	if (sched_setscheduler(0, SCHED_FIFO, &param))
+		die("sched_setscheduler()");
+	print_cpu_ctrl(0);
+	fprintf(stdout, "# isa %s\n", isa_names[isa_level()]);
+
+#ifdef CONFIG_TRACE
+	/*
+	 * Tracing is enabled for the whole run, but only the kernels are
+	 * instrumented, so the page-in loop of the prologue is not recorded.
+	 */
+	if (trace_path && (trace_open(trace_path) || trace_thread_init()))
+		die(trace_path);
+#endif
+	if (optind == argc)
+		for (b = benchmarks; b->name; b++)
+			if (!b->on_demand)
+				b->run();
+	for (i = optind; i < argc; i++)
+		find_benchmark(argv[i])->run();
+#ifdef CONFIG_TRACE
+	if (trace_path) {
+		long long records = trace_close();
+
+		if (records < 0)
+			die(trace_path);
+		fprintf(stderr, "%lld records written to %s\n", records,
+			trace_path);
+	}
+#endif
 	return 0;
 }
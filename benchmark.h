@@ -0,0 +1,129 @@
+/*
+ * benchmark.h	- helpers shared by the benchmarks registered in benchmark.c.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define GIGABYTES(x)    ((long long)(x) << 30)
+#define MEGABYTES(x)    ((long long)(x) << 20)
+#define KILOBYTES(x)    ((long long)(x) << 10)
+
+struct benchmark {
+	const char *name;
+	const char *desc;
+	void (*run)(void);
+	bool on_demand;		/* only run when named on the command line */
+	bool traced;		/* kernels call TRACE_LOAD()/TRACE_STORE() */
+};
+
+void die(const char *str) __attribute__((__noreturn__));
+
+void benchmark_prologue(struct timeval *start, uint8_t *buf, size_t size);
+void benchmark_epilogue(struct timeval *start, size_t step);
+
+/**
+ * Invalidate the cache line that contains the linear address specified with
+ * @p from all levels of the processor cache hierarchy (data and instruction)
+ *
+ * Please NOTE: The data is not written-back but invalidated.
+ */
+static inline void clflush(volatile void *p)
+{
+	asm volatile ("clflush (%0)" :: "r"(p));
+}
+
+/* Load one byte from @p, the compiler can neither drop nor move it. */
+static inline void maccess(const void *p)
+{
+	asm volatile ("movb (%0), %%al" :: "r"(p) : "eax", "memory");
+}
+
+/*
+ * Time stamps bracketing a measured region: older loads and stores are done
+ * before the first one is read, and the region has retired before the
+ * second one is.
+ */
+static inline uint64_t tsc_start(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("mfence\n\tlfence\n\trdtsc" : "=a"(lo), "=d"(hi) ::
+		      "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t tsc_stop(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) :: "ecx",
+		      "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * A time stamp that fences nothing: rdtscp waits for earlier instructions
+ * to execute, not for their stores to drain, and later ones may start
+ * before it. For stamps inside a loop whose own cost is being measured.
+ */
+static inline uint64_t tsc_read(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("rdtscp" : "=a"(lo), "=d"(hi) :: "ecx", "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * Reload the TLB entry for @p through the other half of its page, so that
+ * walking a large set of pages right before timing @p does not add a page
+ * walk to its latency. The line touched is in a different set than @p at
+ * every cache level.
+ */
+static inline void tlb_warm(const void *p)
+{
+	maccess((const void *)((uintptr_t)p ^ 0x800));
+}
+
+/* Latency of one load from @p in TSC cycles, including the fence overhead. */
+static inline unsigned access_latency(const void *p)
+{
+	uint64_t t0 = tsc_start();
+
+	maccess(p);
+	return tsc_stop() - t0;
+}
+
+/* qsort() comparator of unsigned ints, the one median() sorts with. */
+int cmp_unsigned(const void *a, const void *b);
+
+/* Median of @n values, @v is reordered. */
+unsigned median(unsigned *v, int n);
+
+/* Benchmarks implemented in their own files. */
+void replacement_benchmark(void);
+void inclusion_benchmark(void);
+void linesize_benchmark(void);
+void dram_benchmark(void);
+void memops_benchmark(void);
+void libc_benchmark(void);
+void tunables_benchmark(void);
+void prefault_benchmark(void);
+void kbench_benchmark(void);
+void pat_benchmark(void);
+void flush_benchmark(void);
+void occupancy_benchmark(void);
+void tune_benchmark(void);
+void smt_benchmark(void);
+void gather_benchmark(void);
+void streams_benchmark(void);
+void fences_benchmark(void);
+
+#endif /* BENCHMARK_H */
@@ -0,0 +1,360 @@
+/*
+ * cachehealth.c	- low duty cycle probe of L2/L3 load latency, to spot
+ * 			  co-runners eating the shared cache.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every interval a few pointer chases (chase.c) run over buffers sized at
+ * fractions of the enumerated L2 and L3: half of L2, a quarter and half of
+ * L3. No probe fills the whole L3, it would evict the co-runners it is
+ * there to detect. A chase whose buffer no longer fits in what is left of the
+ * cache to us gets slower, so the latency of each probe is compared with a
+ * baseline taken on the same host: the first samples of the run, or the
+ * ones saved with -b by an earlier run on a quiet host.
+ *
+ * Each sample is appended to a log (-o) as
+ *
+ *	<unix time> <probe> <bytes> <latency ns> <baseline ns> <drift>
+ *
+ * and/or written to a Prometheus node_exporter textfile (-p), replaced
+ * atomically, with the gauges cachehealth_latency_ns,
+ * cachehealth_baseline_ns and cachehealth_drift_ratio labelled by probe,
+ * and cachehealth_degraded, 1 when a probe drifted more than -t percent.
+ * A sample first times a walk over links spread across each buffer, none of
+ * them touched since the last sample, so the latency shows how much of the
+ * buffer survived the interval. Only then is every buffer loaded back, one
+ * load per line in address order, which the prefetchers stream at memory
+ * bandwidth. That is a few ms for a large L3; -i keeps the duty cycle low.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cacheinfo.h"
+#include "chase.h"
+#include "util.h"
+
+#define CH_RUNS		5		/* chases per probe, median taken */
+#define CH_STEPS	(1 << 13)	/* at most links per chase */
+#define CH_BASELINE	5		/* samples making up the baseline */
+
+struct probe {
+	const char *name;
+	unsigned level, num, den;	/* num/den of the level's size */
+	size_t size;
+	void *buf;
+	void **head, **pos;		/* where the last sample stopped */
+	double latency, baseline;
+};
+
+static struct probe probes[] = {
+	{ "l2_half", 2, 1, 2 },
+	{ "l3_quarter", 3, 1, 4 },
+	{ "l3_half", 3, 1, 2 },
+};
+#define CH_NPROBES	(sizeof(probes) / sizeof(probes[0]))
+
+static unsigned seed = 0xc4e;
+
+static void die(const char *str) __attribute__((__noreturn__));
+
+/* Exit program */
+static void die(const char *str)
+{
+	perror(str);
+	exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-i SECS] [-n COUNT] [-c CPU] [-b FILE] [-o FILE] "
+		"[-p FILE] [-t PCT]\n"
+		"  -i  seconds between samples (default 60)\n"
+		"  -n  stop after COUNT samples (default: never)\n"
+		"  -c  cpu to run the probes on\n"
+		"  -b  baseline file, read if it exists, else written from the "
+		"first samples\n"
+		"  -o  append every sample to FILE (- for stdout)\n"
+		"  -p  Prometheus textfile to replace after every sample\n"
+		"  -t  drift in percent flagged as degraded (default 25)\n",
+		prog);
+	exit(2);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double probe_run(struct probe *p)
+{
+	size_t steps = p->size / 64 / CH_RUNS;
+	double ns[CH_RUNS], start;
+	int r;
+
+	/*
+	 * No warm up: each chase times the next links of the cycle, which land
+	 * all over the buffer, as the interval left them. The walk carries on
+	 * from the last sample, and never wraps within one, so no link is
+	 * timed after it was reloaded.
+	 */
+	if (steps > CH_STEPS)
+		steps = CH_STEPS;
+	for (r = 0; r < CH_RUNS; r++) {
+		start = now_ns();
+		p->pos = chase_run(p->pos, steps);
+		ns[r] = (now_ns() - start) / steps;
+	}
+	qsort(ns, CH_RUNS, sizeof(*ns), cmp_double);
+	return ns[CH_RUNS / 2];
+}
+
+/* Load every line of the buffer back, for the next sample to find. */
+static void probe_reload(struct probe *p)
+{
+	volatile char *c = p->buf;
+	size_t off;
+
+	for (off = 0; off < p->size; off += 64)
+		(void)c[off];
+}
+
+/*
+ * Time every probe, then reload them. The L3 walks and reloads evict L2, so
+ * the L2 probe is timed first and reloaded last.
+ */
+static void probes_sample(double *ns)
+{
+	unsigned i;
+
+	for (i = 0; i < CH_NPROBES; i++)
+		if (probes[i].head)
+			ns[i] = probe_run(&probes[i]);
+	for (i = CH_NPROBES; i-- > 0; )
+		if (probes[i].head)
+			probe_reload(&probes[i]);
+}
+
+static int probes_init(void)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < CH_NPROBES; i++) {
+		struct probe *p = &probes[i];
+		size_t level = cache_level_size(p->level);
+
+		if (!level)
+			continue;
+		p->size = level / p->den * p->num;
+		p->buf = mmap(NULL, p->size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (p->buf == MAP_FAILED)
+			die("mmap()");
+		if (!(p->head = chase_build(p->buf, p->size, 64, &seed)))
+			die("chase_build()");
+		p->pos = p->head;
+		n++;
+	}
+	return n;
+}
+
+static int baseline_load(const char *file)
+{
+	char name[64];
+	double ns;
+	FILE *fp;
+	size_t size;
+	unsigned i, n = 0;
+
+	if (!(fp = fopen(file, "r")))
+		return -1;
+	while (fscanf(fp, "%63s %zu %lf", name, &size, &ns) == 3)
+		for (i = 0; i < CH_NPROBES; i++)
+			if (probes[i].head && probes[i].size == size &&
+			    !strcmp(probes[i].name, name)) {
+				probes[i].baseline = ns;
+				n++;
+			}
+	fclose(fp);
+	/* A baseline from another host, or cache layout, is no baseline. */
+	for (i = 0; i < CH_NPROBES; i++)
+		if (probes[i].head && !probes[i].baseline)
+			return -1;
+	return n ? 0 : -1;
+}
+
+static void baseline_save(const char *file)
+{
+	unsigned i;
+	FILE *fp;
+
+	if (!(fp = fopen(file, "w")))
+		die(file);
+	for (i = 0; i < CH_NPROBES; i++)
+		if (probes[i].head)
+			fprintf(fp, "%s %zu %.3f\n", probes[i].name,
+				probes[i].size, probes[i].baseline);
+	if (fclose(fp))
+		die(file);
+}
+
+/* Baseline samples wait out the same interval as the ones compared to them. */
+static void baseline_measure(unsigned long interval)
+{
+	double ns[CH_BASELINE][CH_NPROBES], sorted[CH_BASELINE];
+	unsigned i, s;
+
+	for (s = 0; s < CH_BASELINE; s++) {
+		sleep(interval);
+		probes_sample(ns[s]);
+	}
+	for (i = 0; i < CH_NPROBES; i++) {
+		if (!probes[i].head)
+			continue;
+		for (s = 0; s < CH_BASELINE; s++)
+			sorted[s] = ns[s][i];
+		qsort(sorted, CH_BASELINE, sizeof(double), cmp_double);
+		probes[i].baseline = sorted[CH_BASELINE / 2];
+	}
+}
+
+static void prom_write(const char *file, double threshold)
+{
+	char tmp[4096];
+	unsigned i;
+	int degraded = 0;
+	FILE *fp;
+
+	/* node_exporter may read at any time, so write aside and rename. */
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+	if (!(fp = fopen(tmp, "w")))
+		die(tmp);
+	fprintf(fp, "# HELP cachehealth_latency_ns Load latency of the "
+		"pointer chase probe.\n# TYPE cachehealth_latency_ns gauge\n");
+	for (i = 0; i < CH_NPROBES; i++)
+		if (probes[i].head)
+			fprintf(fp, "cachehealth_latency_ns{probe=\"%s\","
+				"bytes=\"%zu\"} %.3f\n", probes[i].name,
+				probes[i].size, probes[i].latency);
+	fprintf(fp, "# HELP cachehealth_baseline_ns Probe latency on the "
+		"quiet host.\n# TYPE cachehealth_baseline_ns gauge\n");
+	for (i = 0; i < CH_NPROBES; i++)
+		if (probes[i].head)
+			fprintf(fp, "cachehealth_baseline_ns{probe=\"%s\","
+				"bytes=\"%zu\"} %.3f\n", probes[i].name,
+				probes[i].size, probes[i].baseline);
+	fprintf(fp, "# HELP cachehealth_drift_ratio Latency over baseline, "
+		"minus one.\n# TYPE cachehealth_drift_ratio gauge\n");
+	for (i = 0; i < CH_NPROBES; i++) {
+		double drift;
+
+		if (!probes[i].head)
+			continue;
+		drift = probes[i].latency / probes[i].baseline - 1;
+		if (drift * 100 > threshold)
+			degraded = 1;
+		fprintf(fp, "cachehealth_drift_ratio{probe=\"%s\","
+			"bytes=\"%zu\"} %.4f\n", probes[i].name,
+			probes[i].size, drift);
+	}
+	fprintf(fp, "# HELP cachehealth_degraded A probe drifted past the "
+		"threshold.\n# TYPE cachehealth_degraded gauge\n"
+		"cachehealth_degraded %d\n", degraded);
+	if (fclose(fp) || rename(tmp, file))
+		die(file);
+}
+
+int main(int argc, char **argv)
+{
+	const char *base_file = NULL, *log_file = NULL, *prom_file = NULL;
+	unsigned long interval = 60, count = 0, n;
+	double threshold = 25;
+	FILE *log = NULL;
+	int cpu = -1, opt;
+	unsigned i;
+
+	while ((opt = getopt(argc, argv, "i:n:c:b:o:p:t:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'b':
+			base_file = optarg;
+			break;
+		case 'o':
+			log_file = optarg;
+			break;
+		case 'p':
+			prom_file = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc || (!log_file && !prom_file))
+		usage(argv[0]);
+
+	if (cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			die("sched_setaffinity()");
+	}
+	if (!probes_init()) {
+		fprintf(stderr, "No L2 or L3 enumerated\n");
+		return 1;
+	}
+	if (log_file) {
+		if (!strcmp(log_file, "-"))
+			log = stdout;
+		else if (!(log = fopen(log_file, "a")))
+			die(log_file);
+		setvbuf(log, NULL, _IOLBF, 0);
+	}
+	if (!base_file || baseline_load(base_file)) {
+		baseline_measure(interval);
+		if (base_file)
+			baseline_save(base_file);
+	}
+
+	for (n = 0; !count || n < count; n++) {
+		double ns[CH_NPROBES];
+		time_t now;
+
+		sleep(interval);
+		now = time(NULL);
+		probes_sample(ns);
+		for (i = 0; i < CH_NPROBES; i++)
+			if (probes[i].head)
+				probes[i].latency = ns[i];
+		for (i = 0; log && i < CH_NPROBES; i++)
+			if (probes[i].head)
+				fprintf(log, "%lld %s %zu %.3f %.3f %.4f\n",
+					(long long)now, probes[i].name,
+					probes[i].size, probes[i].latency,
+					probes[i].baseline, probes[i].latency /
+					probes[i].baseline - 1);
+		if (prom_file)
+			prom_write(prom_file, threshold);
+	}
+	return 0;
+}
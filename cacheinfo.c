@@ -0,0 +1,97 @@
+/*
+ * cacheinfo.c	- decode CPUID leaf 04H into struct cache_info descriptors.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * See the theory section in enumerate.c for the register layout.
+ */
+#include "cacheinfo.h"
+
+int cache_enumerate(struct cache_info *ci, int max)
+{
+	uint32_t type, eax, ebx, ecx, edx;
+	int index;
+
+	for (index = 0; index < max; index++) {
+		struct cache_info *c = &ci[index];
+
+		cpuid(0x04, index, &eax, &ebx, &ecx, &edx);
+		/*
+		 * Process contents of register EAX.
+		 *
+		 *  - Bits 04 - 00: Cache Type Field.
+		 *  - Bits 07 - 05: Cache Level (starts at 1).
+		 *  - Bit  08: does not need SW initialization.
+		 *  - Bit  09: Fully Associative cache.
+		 *  - Bits 25 - 14: Maximum number of addressable IDs for
+		 *    logical processors sharing this cache.
+		 */
+		if (!(type = eax & 0x0000001F))
+			break;
+		c->type = type;
+		c->level = (eax >> 5) & 0x00000007;
+		c->self_init = (eax >> 8) & 0x00000001;
+		c->fully_associative = (eax >> 9) & 0x00000001;
+		c->sharing = ((eax >> 14) & 0x00000FFF) + 1;
+		/*
+		 * Process contents of register EBX.
+		 * - Bits 11 - 00: L = System Coherency Line Size**.
+		 * - Bits 21 - 12: P = Physical Line partitions**.
+		 * - Bits 31 - 22: W = Ways of associativity**.
+		 */
+		c->line_size = (ebx & 0x00000FFF) + 1;
+		c->line_partitions = ((ebx >> 12) & 0x000003FF) + 1;
+		c->ways = ((ebx >> 22) & 0x000003FF) + 1;
+		/*
+		 * Process contents of register ECX.
+		 * - Bits 31-00: S = Number of Sets**.
+		 */
+		c->sets = ecx + 1;
+		/*
+		 * Process contents of register EDX.
+		 * - Bit 00: Write-Back Invalidate/Invalidate.
+		 * - Bit 01: Cache Inclusiveness.
+		 * - Bit 02: Complex Cache Indexing.
+		 */
+		c->wbinvd = edx & 0x00000001;
+		c->inclusive = edx & 0x00000002;
+		c->complex_indexing = edx & 0x00000004;
+
+		c->size = (size_t)c->ways * c->line_partitions *
+			c->line_size * c->sets;
+	}
+	return index;
+}
+
+const struct cache_info *cache_data_level(const struct cache_info *ci, int n,
+					  unsigned level)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (ci[i].level == level && ci[i].type != CACHE_TYPE_INSTN)
+			return &ci[i];
+	return NULL;
+}
+
+size_t cache_level_size(unsigned level)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c;
+	int n;
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	c = cache_data_level(ci, n, level);
+	return c ? c->size : 0;
+}
+
+unsigned cache_line_size(void)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c;
+	int n;
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	c = cache_data_level(ci, n, 1);
+	return c ? c->line_size : 64;
+}
@@ -0,0 +1,74 @@
+/*
+ * cacheinfo.h	- decoded CPUID leaf 04H (deterministic cache parameters)
+ * 		  descriptors shared by enumerate and the tools built on it.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef CACHEINFO_H
+#define CACHEINFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Maximum number of leaf 04H sub-leaves we keep. */
+#define CACHE_MAX_DESC	16
+
+/* Cache Type Field, EAX[04:00]. */
+enum cache_type {
+	CACHE_TYPE_NULL		= 0,
+	CACHE_TYPE_DATA		= 1,
+	CACHE_TYPE_INSTN	= 2,
+	CACHE_TYPE_UNIFIED	= 3,
+};
+
+/*
+ * One decoded sub-leaf of CPUID leaf 04H. The boolean fields carry the
+ * architectural meaning of the bit (e.g. @inclusive is true when EDX[1] says
+ * the cache is inclusive of lower levels), not the way enumerate prints them.
+ */
+struct cache_info {
+	unsigned type;			/* enum cache_type */
+	unsigned level;			/* starts at 1 */
+	unsigned sets;
+	unsigned line_size;
+	unsigned line_partitions;
+	unsigned ways;
+	unsigned sharing;		/* max logical processors sharing */
+	size_t size;			/* in bytes */
+	bool self_init;
+	bool fully_associative;
+	bool wbinvd;			/* EDX[0] */
+	bool inclusive;			/* EDX[1] */
+	bool complex_indexing;		/* EDX[2] */
+};
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+			 uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	*eax = leaf;
+	*ecx = subleaf;
+	asm volatile("cpuid": "+a" (*eax), "=b" (*ebx), "+c" (*ecx),
+		     "=d" (*edx));
+}
+
+/*
+ * Fill @ci with up to @max descriptors in sub-leaf order and return how many
+ * were found.
+ */
+int cache_enumerate(struct cache_info *ci, int max);
+
+/*
+ * Return the data or unified cache at @level from the @n descriptors in @ci,
+ * or NULL if the level does not exist.
+ */
+const struct cache_info *cache_data_level(const struct cache_info *ci, int n,
+					  unsigned level);
+
+/* Size in bytes of the data/unified cache at @level on this host, or 0. */
+size_t cache_level_size(unsigned level);
+
+/* Coherency line size reported for L1D, 64 if it cannot be enumerated. */
+unsigned cache_line_size(void);
+
+#endif /* CACHEINFO_H */
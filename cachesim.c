@@ -0,0 +1,288 @@
+/*
+ * cachesim.c	- replay a memory access trace through a simulated cache
+ * 		  hierarchy, by default the one enumerated on this host.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The trace is read from a file or stdin, one access per line:
+ *
+ *	R 7ffd5c0a1e40
+ *	W 0x7ffd5c0a1e48
+ *
+ * Lines starting with '#' are ignored. Binary traces recorded through
+ * trace.h (e.g. by benchmark-trace -t) are recognised by their header.
+ *
+ * Each -l option describes one level, from L1 downwards, and replaces the
+ * enumerated hierarchy:
+ *
+ *	-l SIZE:WAYS[:REPL[:INCL]]	e.g. -l 32k:8 -l 1M:16:plru:inclusive
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "trace.h"
+
+#define REPLAY_BUF	(1 << 20)	/* text trace read size */
+
+static void die(const char *str) __attribute__((__noreturn__));
+
+/* Exit program */
+static void die(const char *str)
+{
+	perror(str);
+	exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-l SIZE:WAYS[:REPL[:INCL]]]... [-r REPL] "
+		"[-L LINE] [-t] [-n] [-s SEED] [TRACE]\n"
+		"  -l  add a level (replaces the enumerated hierarchy)\n"
+		"  -r  replacement for every level: lru, plru, qlru, random\n"
+		"  -L  line size in bytes\n"
+		"  -t  write-through instead of write-back\n"
+		"  -n  no-write-allocate instead of write-allocate\n"
+		"  -s  seed for random replacement\n", prog);
+	exit(2);
+}
+
+/* Parse "32k", "2M", "1G" or plain bytes. */
+static size_t parse_size(const char *str, char **end)
+{
+	size_t v = strtoull(str, end, 0);
+
+	switch (**end) {
+	case 'g': case 'G':
+		v <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		v <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		v <<= 10;
+		(*end)++;
+	}
+	return v;
+}
+
+static int parse_level(const char *arg, struct sim_level_config *cfg)
+{
+	char *end, *tok, *copy;
+	int ret = -1, v;
+
+	cfg->size = parse_size(arg, &end);
+	if (*end++ != ':')
+		return -1;
+	cfg->ways = strtoul(end, &end, 0);
+	if (*end && *end != ':')
+		return -1;
+	if (!(copy = strdup(*end ? end + 1 : "")))
+		die("strdup()");
+	if ((tok = strtok(copy, ":"))) {
+		if ((v = sim_repl_parse(tok)) < 0)
+			goto out;
+		cfg->repl = v;
+		if ((tok = strtok(NULL, ":"))) {
+			if ((v = sim_incl_parse(tok)) < 0)
+				goto out;
+			cfg->incl = v;
+		}
+	}
+	ret = 0;
+out:
+	free(copy);
+	return ret;
+}
+
+static uint64_t replay_binary(struct sim *s, FILE *fp)
+{
+	struct trace_reader r;
+	uint64_t addr, n = 0;
+	uint32_t tid;
+	bool write;
+	int ret;
+
+	trace_reader_init(&r, fp);
+	while ((ret = trace_next(&r, &addr, &write, &tid)) > 0) {
+		sim_access(s, addr, write);
+		n++;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Malformed trace after %llu records\n",
+			(unsigned long long)n);
+		exit(1);
+	}
+	return n;
+}
+
+static inline int hex_digit(unsigned char c)
+{
+	if (c - '0' < 10U)
+		return c - '0';
+	c |= 0x20;
+	if (c - 'a' < 6U)
+		return c - 'a' + 10;
+	return -1;
+}
+
+/*
+ * Parse one text record in [@p, @end), a line without its newline. Returns
+ * false for comments, blank lines and anything else that is not a record.
+ */
+static inline bool parse_record(const char *p, const char *end,
+				uint64_t *addr, bool *write)
+{
+	uint64_t v = 0;
+	int d, digits = 0;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p == end)
+		return false;
+	if (*p == 'R' || *p == 'r')
+		*write = false;
+	else if (*p == 'W' || *p == 'w')
+		*write = true;
+	else
+		return false;
+	for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+		;
+	if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' &&
+	    hex_digit(p[2]) >= 0)
+		p += 2;
+	for (; p < end && (d = hex_digit(*p)) >= 0; p++, digits++)
+		v = v << 4 | d;
+	*addr = v;
+	return digits;
+}
+
+/*
+ * Text traces are read in large blocks and parsed by hand: fgets() and
+ * strtoull() cost more than simulating a hit.
+ */
+static uint64_t replay(struct sim *s, FILE *fp)
+{
+	static char buf[REPLAY_BUF];
+	size_t len = 0, got;
+	uint64_t n = 0;
+
+	while ((got = fread(buf + len, 1, sizeof(buf) - len, fp)) || len) {
+		const char *p = buf, *end = buf + len + got, *nl;
+		bool eof = !got;
+
+		len += got;
+		while ((nl = memchr(p, '\n', end - p)) ||
+		       (eof && p < end && (nl = end))) {
+			uint64_t addr;
+			bool write;
+
+			if (parse_record(p, nl, &addr, &write)) {
+				sim_access(s, addr, write);
+				n++;
+			}
+			p = nl + (nl < end);
+		}
+		len = end - p;
+		/* A line longer than the buffer is not a record, drop it. */
+		if (len == sizeof(buf))
+			len = 0;
+		memmove(buf, p, len);
+		if (eof)
+			break;
+	}
+	if (ferror(fp))
+		die("read");
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct sim_level_config cfg[SIM_MAX_LEVELS];
+	struct timespec start, stop;
+	unsigned line_size = 0, host_line;
+	bool write_through = false, no_alloc = false;
+	int repl = -1, n = 0, i, opt;
+	uint64_t seed = 0, accesses;
+	struct sim s;
+	double secs;
+	FILE *fp = stdin;
+
+	while ((opt = getopt(argc, argv, "l:r:L:tns:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			if (n == SIM_MAX_LEVELS)
+				usage(argv[0]);
+			memset(&cfg[n], 0, sizeof(cfg[n]));
+			if (parse_level(optarg, &cfg[n]))
+				usage(argv[0]);
+			n++;
+			break;
+		case 'r':
+			if ((repl = sim_repl_parse(optarg)) < 0)
+				usage(argv[0]);
+			break;
+		case 'L':
+			line_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			write_through = true;
+			break;
+		case 'n':
+			no_alloc = true;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 < argc)
+		usage(argv[0]);
+	if (optind < argc && strcmp(argv[optind], "-") &&
+	    !(fp = fopen(argv[optind], "r")))
+		die(argv[optind]);
+
+	if (!n) {
+		n = sim_config_from_host(cfg, SIM_MAX_LEVELS, SIM_REPL_LRU,
+					 &host_line);
+		if (!n) {
+			fprintf(stderr, "No data caches enumerated, use -l\n");
+			return 1;
+		}
+		if (!line_size)
+			line_size = host_line;
+	}
+	if (!line_size)
+		line_size = 64;
+	for (i = 0; i < n; i++) {
+		if (repl >= 0)
+			cfg[i].repl = repl;
+		cfg[i].write_back = !write_through;
+		cfg[i].write_allocate = !no_alloc;
+	}
+	if (sim_init(&s, cfg, n, line_size, seed))
+		die("sim_init()");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	accesses = trace_probe(fp) ? replay_binary(&s, fp) : replay(&s, fp);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	secs = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	sim_report(&s, stdout);
+	fprintf(stdout, "Replayed %llu accesses in %.3f s (%.1f M/s)\n",
+		(unsigned long long)accesses, secs,
+		secs > 0 ? accesses / secs / 1e6 : 0.0);
+	sim_destroy(&s);
+	if (fp != stdin)
+		fclose(fp);
+	return 0;
+}
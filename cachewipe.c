@@ -0,0 +1,329 @@
+/*
+ * cachewipe.c	- run a command from cold caches and report its resource
+ * 		  usage and hardware counters.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Before the command starts, cachewipe moves to every cpu it will run on
+ * and loads a buffer twice the size of that cpu's private levels, then
+ * loads twice the LLC from one cpu of every LLC domain among them, which
+ * leaves no line of anything that ran before in L1D, L2 or L3, and only
+ * clean lines in their place. Sizes come from leaf 04H. Instruction caches
+ * are not wiped. -f drops the page cache of a file (written back first)
+ * and -p drops the whole page cache (root), for a cold start from storage
+ * too.
+ *
+ * The command runs on the cpus of -c, or on those sharing cache level -l
+ * with cpu -n (cpu 0 by default), or where cachewipe may run. Its counters
+ * are opened on the child before it exec's, enabled on exec and inherited
+ * by its threads and children; they are printed on stderr with its rusage
+ * once it exits. A counter the cpu or hypervisor does not offer reads "-".
+ * The exit status is the command's.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "cacheinfo.h"
+#include "topology.h"
+#include "util.h"
+
+#define CW_MAX_FILES	64
+
+#define CW_CACHE(c, op, res)	((PERF_COUNT_HW_CACHE_##c) | \
+				 (PERF_COUNT_HW_CACHE_OP_##op << 8) | \
+				 (PERF_COUNT_HW_CACHE_RESULT_##res << 16))
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} cw_events[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-references", PERF_TYPE_HARDWARE,
+	  PERF_COUNT_HW_CACHE_REFERENCES },
+	{ "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+	  CW_CACHE(L1D, READ, MISS) },
+	{ "LLC-load-misses", PERF_TYPE_HW_CACHE, CW_CACHE(LL, READ, MISS) },
+	{ "dTLB-load-misses", PERF_TYPE_HW_CACHE, CW_CACHE(DTLB, READ, MISS) },
+	{ "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+#define CW_NEVENTS	(sizeof(cw_events) / sizeof(cw_events[0]))
+
+static void die(const char *str) __attribute__((__noreturn__));
+
+/* Exit program */
+static void die(const char *str)
+{
+	perror(str);
+	exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c CPUS | -l LEVEL [-n CPU]] [-f FILE]... [-p] "
+		"[-N] COMMAND [ARGS]...\n"
+		"  -c  cpus to run the command on, e.g. 0-3,8\n"
+		"  -l  run on the cpus sharing cache LEVEL with cpu -n\n"
+		"  -n  cpu whose sharing domain -l picks (default 0)\n"
+		"  -f  drop FILE from the page cache\n"
+		"  -p  drop the whole page cache (root)\n"
+		"  -N  do not wipe the cpu caches\n", prog);
+	exit(2);
+}
+
+/*
+ * Load every line of @buf, twice, in two directions. Loads only, so that
+ * what is left in the caches is clean: a store sweep would leave them full
+ * of dirty lines that the command then pays to write back.
+ */
+static void sweep(const uint8_t *buf, size_t size)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < size; i += 64)
+		sum += *(const volatile uint8_t *)(buf + i);
+	for (i = size; i; i -= 64)
+		sum += *(const volatile uint8_t *)(buf + i - 64);
+	asm volatile ("" :: "r"(sum));
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t one;
+
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	if (sched_setaffinity(0, sizeof(one), &one))
+		die("sched_setaffinity()");
+}
+
+static void wipe(const cpu_set_t *cpus)
+{
+	size_t llc = cache_level_size(3), priv = 0, size;
+	cpu_set_t self, done, llcs;
+	unsigned level;
+	uint8_t *buf;
+	int cpu;
+
+	for (level = 1; level <= 2; level++)
+		priv += cache_level_size(level);
+	size = 2 * (llc > priv ? llc : priv);
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap()");
+	/*
+	 * Clearing the pages left the end of the buffer dirty in the LLC. One
+	 * pass over all of it evicts those lines, so the sweeps that follow
+	 * fill the caches with clean ones.
+	 */
+	sweep(buf, size);
+	if (sched_getaffinity(0, sizeof(self), &self))
+		die("sched_getaffinity()");
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpus))
+			continue;
+		pin(cpu);
+		sweep(buf, 2 * priv);
+	}
+	/*
+	 * The LLCs last, so the private sweeps do not refill them: once from a
+	 * cpu of every LLC domain the command runs in.
+	 */
+	CPU_ZERO(&done);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, cpus) || CPU_ISSET(cpu, &done))
+			continue;
+		if (cache_domain(cpu, 0, &llcs))
+			CPU_ZERO(&llcs);
+		CPU_SET(cpu, &llcs);
+		CPU_OR(&done, &done, &llcs);
+		pin(cpu);
+		sweep(buf, size);
+	}
+	if (sched_setaffinity(0, sizeof(self), &self))
+		die("sched_setaffinity()");
+	munmap(buf, size);
+}
+
+static void drop_file(const char *file)
+{
+	int fd = open(file, O_RDONLY);
+
+	if (fd < 0)
+		die(file);
+	/* Dirty pages are not dropped, write them back first. */
+	if (fdatasync(fd) && errno != EINVAL)
+		die(file);
+	errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (errno)
+		die(file);
+	close(fd);
+}
+
+static void drop_page_cache(void)
+{
+	int fd;
+
+	sync();
+	if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) < 0 ||
+	    write(fd, "1\n", 2) != 2)
+		die("/proc/sys/vm/drop_caches");
+	close(fd);
+}
+
+static int counter_open(int i, pid_t pid)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = cw_events[i].type;
+	attr.config = cw_events[i].config;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(__NR_perf_event_open, &attr, pid, -1, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+static void counter_print(int i, int fd)
+{
+	uint64_t v[3];
+
+	if (fd < 0 || read(fd, v, sizeof(v)) != sizeof(v) || !v[2]) {
+		fprintf(stderr, " %22s %18s\n", cw_events[i].name, "-");
+		return;
+	}
+	/* Scaled up if the counters had to share the PMU. */
+	if (v[2] < v[1])
+		fprintf(stderr, " %22s %18.0f  (%.0f%% counted)\n",
+			cw_events[i].name, (double)v[0] * v[1] / v[2],
+			100.0 * v[2] / v[1]);
+	else
+		fprintf(stderr, " %22s %18llu\n", cw_events[i].name,
+			(unsigned long long)v[0]);
+}
+
+int main(int argc, char **argv)
+{
+	const char *files[CW_MAX_FILES];
+	int fds[CW_NEVENTS], go[2], opt, nfiles = 0, cpu = 0, status, i;
+	bool no_wipe = false, page_cache = false, have_cpus = false;
+	unsigned level = 0;
+	struct rusage ru;
+	cpu_set_t cpus;
+	double t0, wall;
+	pid_t pid;
+	char c;
+
+	while ((opt = getopt(argc, argv, "+c:l:n:f:pNh")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (parse_cpus(optarg, &cpus))
+				usage(argv[0]);
+			have_cpus = true;
+			break;
+		case 'l':
+			level = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			if (nfiles == CW_MAX_FILES)
+				usage(argv[0]);
+			files[nfiles++] = optarg;
+			break;
+		case 'p':
+			page_cache = true;
+			break;
+		case 'N':
+			no_wipe = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || (have_cpus && level))
+		usage(argv[0]);
+	if (level) {
+		if (cache_domain(cpu, level, &cpus)) {
+			fprintf(stderr, "No L%u on cpu %d\n", level, cpu);
+			return 1;
+		}
+	} else if (!have_cpus && sched_getaffinity(0, sizeof(cpus), &cpus)) {
+		die("sched_getaffinity()");
+	}
+
+	/* The child waits for its counters before it exec's. */
+	if (pipe(go))
+		die("pipe()");
+	if ((pid = fork()) < 0)
+		die("fork()");
+	if (!pid) {
+		close(go[1]);
+		if (read(go[0], &c, 1) != 1)
+			_exit(127);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus))
+			die("sched_setaffinity()");
+		execvp(argv[optind], argv + optind);
+		die(argv[optind]);
+	}
+	close(go[0]);
+	for (i = 0; i < (int)CW_NEVENTS; i++)
+		fds[i] = counter_open(i, pid);
+
+	for (i = 0; i < nfiles; i++)
+		drop_file(files[i]);
+	if (page_cache)
+		drop_page_cache();
+	if (!no_wipe)
+		wipe(&cpus);
+
+	t0 = now_ns();
+	if (write(go[1], "", 1) != 1)
+		die("write()");
+	close(go[1]);
+	if (wait4(pid, &status, 0, &ru) < 0)
+		die("wait4()");
+	wall = now_ns() - t0;
+
+	fprintf(stderr, "\ncachewipe: %s, %d cpu%s, %d file%s dropped%s\n",
+		no_wipe ? "caches not wiped" : "L1D/L2/L3 wiped",
+		CPU_COUNT(&cpus), CPU_COUNT(&cpus) > 1 ? "s" : "", nfiles,
+		nfiles == 1 ? "" : "s", page_cache ? ", page cache dropped" : "");
+	fprintf(stderr, " %22s %18.6f\n %22s %18.6f\n %22s %18.6f\n",
+		"wall s", wall / 1e9,
+		"user s", ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+		"sys s", ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+	fprintf(stderr, " %22s %18ld\n %22s %18ld\n %22s %18ld\n"
+		" %22s %18ld\n %22s %18ld\n %22s %18ld\n %22s %18ld\n",
+		"max rss KB", ru.ru_maxrss, "minor faults", ru.ru_minflt,
+		"major faults", ru.ru_majflt, "blocks in", ru.ru_inblock,
+		"blocks out", ru.ru_oublock, "voluntary switches", ru.ru_nvcsw,
+		"involuntary switches", ru.ru_nivcsw);
+	for (i = 0; i < (int)CW_NEVENTS; i++)
+		counter_print(i, fds[i]);
+	return WIFEXITED(status) ? WEXITSTATUS(status) :
+		128 + WTERMSIG(status);
+}
@@ -0,0 +1,56 @@
+/*
+ * cbench.c	- user side of the read-cr0 module's in-kernel benchmark
+ * 		  runner.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The parameters are written to their debugfs files, a write to "run" runs
+ * the samples on the target cpu, and "result" ends with their min, median
+ * and max in TSC cycles (see read-cr0/cache_bench.c).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cbench.h"
+
+static int cbench_write(const char *file, unsigned long long v)
+{
+	char path[128];
+	FILE *fp;
+	int err;
+
+	snprintf(path, sizeof(path), CBENCH_DIR "/%s", file);
+	if (!(fp = fopen(path, "w")))
+		return -1;
+	fprintf(fp, "%llu\n", v);
+	err = fclose(fp);
+	return err ? -1 : 0;
+}
+
+bool cbench_available(void)
+{
+	return !access(CBENCH_DIR "/run", W_OK);
+}
+
+int cbench_run(enum cache_bench_kernel kernel, size_t size,
+	       unsigned long long count, unsigned samples,
+	       struct cbench_spread *s)
+{
+	char line[256];
+	FILE *fp;
+	int found = 0;
+
+	if (cbench_write("cpu", 0) || cbench_write("kernel", kernel) ||
+	    cbench_write("size", size) || cbench_write("count", count) ||
+	    cbench_write("samples", samples) || cbench_write("run", 1))
+		return -1;
+	if (!(fp = fopen(CBENCH_DIR "/result", "r")))
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "min %llu median %llu max %llu", &s->min,
+			   &s->median, &s->max) == 3)
+			found = 1;
+	fclose(fp);
+	return found ? 0 : -1;
+}
@@ -0,0 +1,35 @@
+/*
+ * cbench.h	- user side of the read-cr0 module's in-kernel benchmark
+ * 		  runner in /sys/kernel/debug/cache_bench.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef CBENCH_H
+#define CBENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "read-cr0/cache_bench.h"
+
+#define CBENCH_DIR	"/sys/kernel/debug/cache_bench"
+#define CBENCH_MAX	(64UL << 20)	/* the module's default buf_mb */
+
+/* min, median and max TSC cycles of the samples of a run. */
+struct cbench_spread {
+	unsigned long long min, median, max;
+};
+
+/* True if the module is loaded, debugfs mounted and we may run it. */
+bool cbench_available(void);
+
+/*
+ * Run @kernel over @size bytes (@count iterations, where it takes them) for
+ * @samples samples on cpu 0, and store their spread in @s. Returns 0, or -1
+ * if a file could not be written or the run failed.
+ */
+int cbench_run(enum cache_bench_kernel kernel, size_t size,
+	       unsigned long long count, unsigned samples,
+	       struct cbench_spread *s);
+
+#endif /* CBENCH_H */
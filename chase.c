@@ -0,0 +1,56 @@
+/*
+ * chase.c	- pointer chasing over a randomly linked buffer.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "chase.h"
+#include "util.h"
+
+void **chase_build(void *buf, size_t size, size_t stride, unsigned *seed)
+{
+	size_t n = size / stride, i, *idx;
+	uint8_t *base = buf;
+
+	if (!n || !(idx = malloc(n * sizeof(*idx))))
+		return NULL;
+	for (i = 0; i < n; i++)
+		idx[i] = i;
+	/* Fisher-Yates, rand_r() only gives 31 bits so combine two. */
+	for (i = n - 1; i > 0; i--) {
+		size_t r = ((size_t)rand_r(seed) << 31) | rand_r(seed);
+		size_t j = r % (i + 1), t = idx[i];
+
+		idx[i] = idx[j];
+		idx[j] = t;
+	}
+	for (i = 0; i < n; i++)
+		*(void **)(base + idx[i] * stride) =
+			base + idx[(i + 1) % n] * stride;
+	free(idx);
+	/* Every element is on the cycle, so the first one will do. */
+	return (void **)base;
+}
+
+void **chase_run(void **p, size_t steps)
+{
+	while (steps--)
+		p = *(void * volatile *)p;
+	return p;
+}
+
+double chase_latency_ns(void **p, size_t warmup, size_t steps)
+{
+	double start, ns;
+
+	p = chase_run(p, warmup);
+	start = now_ns();
+	p = chase_run(p, steps);
+	ns = now_ns() - start;
+	/* Keep the result live so the walk is not optimised out. */
+	asm volatile ("" :: "r"(p));
+	return ns / steps;
+}
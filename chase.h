@@ -0,0 +1,28 @@
+/*
+ * chase.h	- pointer chasing over a randomly linked buffer, the usual way
+ * 		  to measure load-to-use latency without help from prefetchers.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef CHASE_H
+#define CHASE_H
+
+#include <stddef.h>
+
+/*
+ * Link every @stride bytes of @buf[0, @size) into a single cycle in random
+ * order, each element holding the address of the next one. Returns the
+ * first element, or NULL if the index permutation could not be allocated.
+ */
+void **chase_build(void *buf, size_t size, size_t stride, unsigned *seed);
+
+/* Follow @steps links from @p and return where it stopped. */
+void **chase_run(void **p, size_t steps);
+
+/*
+ * Average latency of a load in nanoseconds over @steps links from @p, after
+ * one warm up pass of @warmup links.
+ */
+double chase_latency_ns(void **p, size_t warmup, size_t steps);
+
+#endif /* CHASE_H */
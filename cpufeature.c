@@ -0,0 +1,152 @@
+/*
+ * cpufeature.c	- decode the CPUID feature leaves and XCR0, and pick the ISA
+ * 		  level the kernels run at.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Reference: Intel SDM Vol. 2A, CPUID (leaves 01H, 07H and 80000001H),
+ * and Vol. 1, 13.3 for XCR0.
+ *
+ * A CPUID bit alone does not make an extension usable: the OS has to save
+ * its registers on context switch, which it says by setting CR4.OSXSAVE
+ * (leaf 01H ECX[27]) and the matching XCR0 bits. AVX needs XCR0 SSE and AVX
+ * state, AVX-512 also opmask and both ZMM halves, AMX the tile state. On
+ * Linux AMX additionally needs arch_prctl(ARCH_REQ_XCOMP_PERM) per process
+ * before the first tile instruction, which cpu_has() does not do.
+ */
+#include <string.h>
+
+#include "cacheinfo.h"
+#include "cpufeature.h"
+
+enum { EAX, EBX, ECX, EDX };
+
+struct feature_bit {
+	const char *name;
+	uint32_t leaf, subleaf;
+	unsigned reg, bit;
+	uint64_t xcr0;			/* state the OS must enable */
+};
+
+#define XCR0_YMM	(XCR0_SSE | XCR0_AVX)
+#define XCR0_ZMM	(XCR0_YMM | XCR0_OPMASK | XCR0_ZMM_HI256 | \
+			 XCR0_HI16_ZMM)
+#define XCR0_TILE	(XCR0_TILECFG | XCR0_TILEDATA)
+
+static const struct feature_bit features[CPU_NFEATURES] = {
+	[CPU_SSE42]	 = { "sse4_2", 0x01, 0, ECX, 20, 0 },
+	[CPU_POPCNT]	 = { "popcnt", 0x01, 0, ECX, 23, 0 },
+	[CPU_OSXSAVE]	 = { "osxsave", 0x01, 0, ECX, 27, 0 },
+	[CPU_AVX]	 = { "avx", 0x01, 0, ECX, 28, XCR0_YMM },
+	[CPU_FMA]	 = { "fma", 0x01, 0, ECX, 12, XCR0_YMM },
+	[CPU_AVX2]	 = { "avx2", 0x07, 0, EBX, 5, XCR0_YMM },
+	[CPU_BMI2]	 = { "bmi2", 0x07, 0, EBX, 8, 0 },
+	[CPU_AVX512F]	 = { "avx512f", 0x07, 0, EBX, 16, XCR0_ZMM },
+	[CPU_AVX512DQ]	 = { "avx512dq", 0x07, 0, EBX, 17, XCR0_ZMM },
+	[CPU_AVX512CD]	 = { "avx512cd", 0x07, 0, EBX, 28, XCR0_ZMM },
+	[CPU_AVX512BW]	 = { "avx512bw", 0x07, 0, EBX, 30, XCR0_ZMM },
+	[CPU_AVX512VL]	 = { "avx512vl", 0x07, 0, EBX, 31, XCR0_ZMM },
+	[CPU_AVX512VBMI] = { "avx512vbmi", 0x07, 0, ECX, 1, XCR0_ZMM },
+	[CPU_AVX512VNNI] = { "avx512_vnni", 0x07, 0, ECX, 11, XCR0_ZMM },
+	[CPU_CLFLUSHOPT] = { "clflushopt", 0x07, 0, EBX, 23, 0 },
+	[CPU_CLWB]	 = { "clwb", 0x07, 0, EBX, 24, 0 },
+	[CPU_PREFETCHW]	 = { "3dnowprefetch", 0x80000001, 0, ECX, 8, 0 },
+	[CPU_RTM]	 = { "rtm", 0x07, 0, EBX, 11, 0 },
+	[CPU_MOVDIRI]	 = { "movdiri", 0x07, 0, ECX, 27, 0 },
+	[CPU_MOVDIR64B]	 = { "movdir64b", 0x07, 0, ECX, 28, 0 },
+	[CPU_SERIALIZE]	 = { "serialize", 0x07, 0, EDX, 14, 0 },
+	[CPU_AMX_TILE]	 = { "amx_tile", 0x07, 0, EDX, 24, XCR0_TILE },
+	[CPU_AMX_INT8]	 = { "amx_int8", 0x07, 0, EDX, 25, XCR0_TILE },
+	[CPU_AMX_BF16]	 = { "amx_bf16", 0x07, 0, EDX, 22, XCR0_TILE },
+};
+
+const char *const isa_names[ISA_NLEVELS] = {
+	[ISA_SCALAR]	= "scalar",
+	[ISA_SSE42]	= "sse4.2",
+	[ISA_AVX2]	= "avx2",
+	[ISA_AVX512]	= "avx512",
+};
+
+static enum isa isa_limit = ISA_NLEVELS - 1;
+
+static uint32_t max_leaf(uint32_t base)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(base, 0, &eax, &ebx, &ecx, &edx);
+	return eax;
+}
+
+uint64_t cpu_xcr0(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0x01, 0, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & (1U << 27)))
+		return 0;
+	asm volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (uint64_t)edx << 32 | eax;
+}
+
+const char *cpu_feature_name(enum cpu_feature f)
+{
+	return f < CPU_NFEATURES ? features[f].name : NULL;
+}
+
+bool cpu_reports(enum cpu_feature f)
+{
+	const struct feature_bit *fb;
+	uint32_t r[4];
+
+	if (f >= CPU_NFEATURES)
+		return false;
+	fb = &features[f];
+	if (max_leaf(fb->leaf & 0x80000000) < fb->leaf)
+		return false;
+	cpuid(fb->leaf, fb->subleaf, &r[EAX], &r[EBX], &r[ECX], &r[EDX]);
+	return r[fb->reg] & (1U << fb->bit);
+}
+
+bool cpu_has(enum cpu_feature f)
+{
+	return cpu_reports(f) &&
+	       (cpu_xcr0() & features[f].xcr0) == features[f].xcr0;
+}
+
+enum isa isa_supported(void)
+{
+	if (cpu_has(CPU_AVX512F) && cpu_has(CPU_AVX512BW) &&
+	    cpu_has(CPU_AVX512VL))
+		return ISA_AVX512;
+	if (cpu_has(CPU_AVX2) && cpu_has(CPU_FMA) && cpu_has(CPU_BMI2))
+		return ISA_AVX2;
+	if (cpu_has(CPU_SSE42) && cpu_has(CPU_POPCNT))
+		return ISA_SSE42;
+	return ISA_SCALAR;
+}
+
+enum isa isa_level(void)
+{
+	static int supported = -1;
+
+	if (supported < 0)
+		supported = isa_supported();
+	return (enum isa)supported < isa_limit ? (enum isa)supported :
+		isa_limit;
+}
+
+void isa_force(enum isa isa)
+{
+	if (isa < ISA_NLEVELS)
+		isa_limit = isa;
+}
+
+int isa_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ISA_NLEVELS; i++)
+		if (!strcmp(name, isa_names[i]))
+			return i;
+	return -1;
+}
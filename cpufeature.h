@@ -0,0 +1,97 @@
+/*
+ * cpufeature.h	- decoded CPUID leaf 01H, 07H and 80000001H feature flags,
+ * 		  the state the OS enables in XCR0, and the ISA level the
+ * 		  kernels dispatch on.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef CPUFEATURE_H
+#define CPUFEATURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum cpu_feature {
+	CPU_SSE42,
+	CPU_POPCNT,
+	CPU_OSXSAVE,
+	CPU_AVX,
+	CPU_FMA,
+	CPU_AVX2,
+	CPU_BMI2,
+	CPU_AVX512F,
+	CPU_AVX512DQ,
+	CPU_AVX512CD,
+	CPU_AVX512BW,
+	CPU_AVX512VL,
+	CPU_AVX512VBMI,
+	CPU_AVX512VNNI,
+	CPU_CLFLUSHOPT,
+	CPU_CLWB,
+	CPU_PREFETCHW,
+	CPU_RTM,
+	CPU_MOVDIRI,
+	CPU_MOVDIR64B,
+	CPU_SERIALIZE,
+	CPU_AMX_TILE,
+	CPU_AMX_INT8,
+	CPU_AMX_BF16,
+	CPU_NFEATURES
+};
+
+/* XCR0 state components, the ones the vector registers need. */
+#define XCR0_SSE	(1ULL << 1)
+#define XCR0_AVX	(1ULL << 2)
+#define XCR0_OPMASK	(1ULL << 5)
+#define XCR0_ZMM_HI256	(1ULL << 6)
+#define XCR0_HI16_ZMM	(1ULL << 7)
+#define XCR0_TILECFG	(1ULL << 17)
+#define XCR0_TILEDATA	(1ULL << 18)
+
+/*
+ * Instruction set levels the kernels come in, each a superset of the one
+ * before: SSE4.2, AVX2 (with FMA and BMI2 on every part that has it), and
+ * AVX-512 F/BW/VL, the subset Skylake-SP and later all have.
+ */
+enum isa {
+	ISA_SCALAR,
+	ISA_SSE42,
+	ISA_AVX2,
+	ISA_AVX512,
+	ISA_NLEVELS
+};
+
+extern const char *const isa_names[ISA_NLEVELS];
+
+/* Name of @f as in /proc/cpuinfo. */
+const char *cpu_feature_name(enum cpu_feature f);
+
+/* Whether CPUID reports @f, whatever the OS enables. */
+bool cpu_reports(enum cpu_feature f);
+
+/*
+ * Whether the CPU reports @f and, for the vector and AMX features, the OS
+ * saves the registers they use (XCR0). The answer does not depend on
+ * isa_force().
+ */
+bool cpu_has(enum cpu_feature f);
+
+/* XCR0 as read by xgetbv, 0 if the OS has not set CR4.OSXSAVE. */
+uint64_t cpu_xcr0(void);
+
+/* Widest level the CPU and OS support, ignoring isa_force(). */
+enum isa isa_supported(void);
+
+/*
+ * The level kernels should use: the widest supported one, or the one
+ * forced with isa_force() if that is lower.
+ */
+enum isa isa_level(void);
+
+/* Cap isa_level() at @isa, to compare implementations on one host. */
+void isa_force(enum isa isa);
+
+/* The level named @name ("scalar", "sse4.2", "avx2", "avx512"), or -1. */
+int isa_parse(const char *name);
+
+#endif /* CPUFEATURE_H */
@@ -0,0 +1,282 @@
+/*
+ * dram.c	- DRAM row buffer hits and conflicts, and the physical address
+ * 		  functions that select the bank.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Two uncached lines accessed in turn cost more when they sit in different
+ * rows of the same bank: every access closes the row the other one opened
+ * (a row conflict). Lines in different banks, or in the same row (a row
+ * hit), are served from open rows. Timing a fixed line against many random
+ * others gives a bimodal distribution whose slow mode is the set of lines
+ * in its bank.
+ *
+ * Channel, rank and bank are chosen by XORs of physical address bits. Every
+ * such function has the same value for the fixed line and all lines in its
+ * bank, while it splits random lines in halves, so the functions are the
+ * XOR masks of a few bits that hold on the slow mode but not elsewhere.
+ * Once they are known, the other lines of the fixed line's 4 KB page that
+ * they put in its bank are in its row too, as row bits start above bit 12
+ * on every known mapping, and give the row hit latency.
+ *
+ * Reference:
+ *	P. Pessl et al., "DRAMA: Exploiting DRAM Addressing for Cross-CPU
+ *	Attacks", USENIX Security 2016.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "evset.h"
+
+#define DRAM_POOL	GIGABYTES(1)
+#define DRAM_SAMPLES	4000	/* random lines timed against the base line */
+#define DRAM_ROUNDS	64	/* alternating accesses per pair */
+#define DRAM_LOW_BIT	6
+#define DRAM_HIGH_BIT	34
+#define DRAM_MAX_BITS	4	/* bits per XOR function */
+#define DRAM_MAX_FUNCS	16
+#define DRAM_TOLERANCE	0.95	/* share of conflicts a function must fit */
+
+struct dram_sample {
+	uint8_t *va;
+	uint64_t pa;
+	unsigned cycles;
+};
+
+static unsigned seed = 0xd7a3;
+
+/* Mean cycles per round of alternating uncached loads of @a and @b. */
+static unsigned pair_latency(uint8_t *a, uint8_t *b)
+{
+	uint64_t t0, t1;
+	int r;
+
+	clflush(a);
+	clflush(b);
+	asm volatile ("mfence" ::: "memory");
+	t0 = tsc_start();
+	for (r = 0; r < DRAM_ROUNDS; r++) {
+		maccess(a);
+		maccess(b);
+		clflush(a);
+		clflush(b);
+		asm volatile ("mfence" ::: "memory");
+	}
+	t1 = tsc_stop();
+	return (t1 - t0) / DRAM_ROUNDS;
+}
+
+static uint64_t sample_pa(const struct evpool *p, const uint8_t *va)
+{
+	size_t off = va - p->base;
+
+	return p->pa[off / p->page_size] + off % p->page_size;
+}
+
+/*
+ * Split @n latencies at the widest gap between neighbours in their upper
+ * half, leaving out the top 0.5% which is where interrupts land. Returns the
+ * threshold, or 0 if the gap is too small to tell two modes apart.
+ */
+static unsigned conflict_threshold(const struct dram_sample *s, int n,
+				   unsigned *fast, unsigned *slow)
+{
+	unsigned *v = malloc(n * sizeof(*v)), gap = 0, threshold = 0;
+	int i, at = 0;
+
+	if (!v)
+		die("malloc()");
+	for (i = 0; i < n; i++)
+		v[i] = s[i].cycles;
+	qsort(v, n, sizeof(*v), cmp_unsigned);
+	for (i = n / 2; i < n - n / 200 - 1; i++)
+		if (v[i + 1] - v[i] > gap) {
+			gap = v[i + 1] - v[i];
+			at = i;
+		}
+	*fast = v[at / 2];
+	*slow = v[(at + 1 + n - n / 200) / 2];
+	if (gap * 8 >= *fast)
+		threshold = v[at] + gap / 2;
+	free(v);
+	return threshold;
+}
+
+static bool parity(uint64_t x)
+{
+	return __builtin_parityll(x);
+}
+
+/* Share of the @n samples for which @mask has the parity of @base. */
+static double fits(uint64_t mask, uint64_t base, const struct dram_sample *s,
+		   int n, unsigned threshold, bool conflicts)
+{
+	int i, total = 0, same = 0;
+
+	for (i = 0; i < n; i++) {
+		if ((s[i].cycles > threshold) != conflicts)
+			continue;
+		total++;
+		same += parity(mask & s[i].pa) == parity(mask & base);
+	}
+	return total ? (double)same / total : 0;
+}
+
+/*
+ * Add @mask to the @n functions in @f unless it is an XOR of some of them;
+ * @basis holds them reduced to row echelon form, one per leading bit.
+ */
+static bool add_independent(uint64_t mask, uint64_t *basis, uint64_t *f,
+			    int *n)
+{
+	uint64_t m = mask;
+	int b;
+
+	for (b = DRAM_HIGH_BIT - 1; b >= 0; b--) {
+		if (!(m >> b & 1))
+			continue;
+		if (!basis[b]) {
+			basis[b] = m;
+			f[(*n)++] = mask;
+			return true;
+		}
+		m ^= basis[b];
+	}
+	return false;
+}
+
+/* Visit the masks of @k bits in [@lo, DRAM_HIGH_BIT), in increasing order. */
+static void search(int k, int lo, uint64_t mask, uint64_t base,
+		   const struct dram_sample *s, int n, unsigned threshold,
+		   uint64_t *basis, uint64_t *f, int *nf)
+{
+	int b;
+
+	if (!k) {
+		/*
+		 * A bank function fits the conflicts and splits the rest; bits
+		 * that never vary across the pool fit everything.
+		 */
+		if (*nf < DRAM_MAX_FUNCS &&
+		    fits(mask, base, s, n, threshold, true) >= DRAM_TOLERANCE &&
+		    fits(mask, base, s, n, threshold, false) < 0.75)
+			add_independent(mask, basis, f, nf);
+		return;
+	}
+	for (b = lo; b < DRAM_HIGH_BIT; b++)
+		search(k - 1, b + 1, mask | 1ULL << b, base, s, n, threshold,
+		       basis, f, nf);
+}
+
+static void print_mask(uint64_t mask)
+{
+	int b;
+	bool first = true;
+
+	fprintf(stdout, "   ");
+	for (b = DRAM_LOW_BIT; b < DRAM_HIGH_BIT; b++)
+		if (mask >> b & 1) {
+			fprintf(stdout, "%s%d", first ? "" : " ^ ", b);
+			first = false;
+		}
+	fprintf(stdout, "\n");
+}
+
+/*
+ * Time @base against the other lines of its page that the @nf bank
+ * functions @f put in its bank, so in its row: row hits. Lines timed as
+ * conflicts are counted, they mean the functions are incomplete.
+ */
+static void row_hits(uint8_t *base, uint64_t base_pa,
+		     const struct evpool *p, const uint64_t *f, int nf,
+		     unsigned threshold)
+{
+	unsigned hit[4096 / 64];
+	int i, j, n = 0, slow = 0;
+
+	for (i = 1; i < 4096 / 64; i++) {
+		uint64_t pa = sample_pa(p, base + i * 64);
+
+		for (j = 0; j < nf; j++)
+			if (parity(f[j] & pa) != parity(f[j] & base_pa))
+				break;
+		if (j < nf)
+			continue;
+		hit[n] = pair_latency(base, base + i * 64);
+		slow += hit[n++] > threshold;
+	}
+	if (!n) {
+		fprintf(stdout, " Row hit: no other line of the page in its "
+			"bank\n");
+		return;
+	}
+	fprintf(stdout, " Row hit           %4u cycles per pair, %d lines "
+		"of the same bank and row", median(hit, n), n);
+	if (slow)
+		fprintf(stdout, ", %d timed as conflicts", slow);
+	fputc('\n', stdout);
+}
+
+void dram_benchmark(void)
+{
+	struct dram_sample *s;
+	struct evpool pool;
+	unsigned threshold, fast, slow;
+	uint64_t basis[DRAM_HIGH_BIT] = { 0 }, f[DRAM_MAX_FUNCS], base_pa;
+	uint8_t *base;
+	int i, k, nf = 0, nconf = 0;
+
+	fprintf(stdout, "\nDRAM row buffer conflicts and bank functions\n");
+	if (evpool_init(&pool, DRAM_POOL))
+		die("evpool_init()");
+	if (!(s = malloc(DRAM_SAMPLES * sizeof(*s))))
+		die("malloc()");
+	base = pool.base;
+	base_pa = pool.pa ? sample_pa(&pool, base) : 0;
+
+	for (i = 0; i < DRAM_SAMPLES; i++) {
+		size_t off = ((size_t)rand_r(&seed) << 31 | rand_r(&seed)) %
+			     (pool.size / 64) * 64;
+
+		s[i].va = pool.base + off;
+		s[i].pa = pool.pa ? sample_pa(&pool, s[i].va) : 0;
+		s[i].cycles = pair_latency(base, s[i].va);
+	}
+	threshold = conflict_threshold(s, DRAM_SAMPLES, &fast, &slow);
+	if (!threshold) {
+		fprintf(stdout, " No row conflicts told apart (%u cycles per "
+			"pair), memory may be virtualised or interleaved\n",
+			fast);
+		goto out;
+	}
+	for (i = 0; i < DRAM_SAMPLES; i++)
+		nconf += s[i].cycles > threshold;
+	fprintf(stdout, " Different banks   %4u cycles per pair\n", fast);
+	fprintf(stdout, " Row conflict      %4u cycles per pair, %d of %d "
+		"random lines (~%d banks)\n", slow, nconf, DRAM_SAMPLES,
+		nconf ? (DRAM_SAMPLES + nconf / 2) / nconf : 0);
+
+	if (!pool.pa) {
+		fprintf(stdout, " Bank functions and row hits need physical "
+			"addresses (run as root)\n");
+		goto out;
+	}
+	for (k = 1; k <= DRAM_MAX_BITS; k++)
+		search(k, DRAM_LOW_BIT, 0, base_pa, s, DRAM_SAMPLES, threshold,
+		       basis, f, &nf);
+	fprintf(stdout, " Bank address functions (XOR of physical address "
+		"bits), %d found:\n", nf);
+	for (i = 0; i < nf; i++)
+		print_mask(f[i]);
+	if (nf)
+		row_hits(base, base_pa, &pool, f, nf, threshold);
+	else
+		fprintf(stdout, " Row hit not timed, it needs the bank "
+			"functions\n");
+out:
+	free(s);
+	evpool_destroy(&pool);
+}
@@ -1,6 +1,7 @@
 /*
  * enumerate.c	- use intel x[86/64] cpuid instruction to enumerate the list of
- * 		  cpu caches.
+ * 		  cpu caches, the instruction set extensions and the state the
+ * 		  OS enables for them.
  *
  * Author: Sougata Santra (sougata.santra@gmail.com)
  *
@@ -80,11 +81,22 @@
  * 		Core ID is a subset of bits of the initial APIC ID.
  * 	***** The returned value is constant for valid initial values in ECX.
  * 		Valid ECX values start from 0.
+ *
+ * 	Feature Information Leaves
+ * 	Leaf 01H ECX and EDX, leaf 07H sub-leaf 0 EBX, ECX and EDX, and leaf
+ * 	80000001H ECX hold one bit per extension; the ones the kernels care
+ * 	about are decoded in cpufeature.c. XGETBV with ECX = 0 reads XCR0,
+ * 	whose bits say which register state the OS saves: an extension is only
+ * 	usable when both CPUID and XCR0 say so. The "OS" column below is that
+ * 	second check.
  */
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "cacheinfo.h"
+#include "cpufeature.h"
+
 static const char *header[] =
 {
 "[L]*  	  - Self Initialized",
@@ -122,80 +134,56 @@ static const char *cache_type[] =
 
 static void enumerate_cache(void)
 {
+	struct cache_info ci[CACHE_MAX_DESC];
 	size_t total_size;
-	uint32_t type, eax, ebx, ecx, edx;
-	unsigned level, sets, line_size, line_partitions, ways;
-	bool fully_associative, self_init, wbinvd, inclusive, indexing;
 	char *prefix;
-	int index = 0;
+	int index = 0, n;
 
 	while(header[index])
 		fprintf (stdout, "%s\n", header[index++]);
 
-	index = 0;
-	do {
-
-		eax = 0x04;
-		ecx = index;
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	for (index = 0; index < n; index++) {
+		const struct cache_info *c = &ci[index];
 
-		asm("cpuid": "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
-		/*
-		 * Process contents of register EAX.
-		 *
-		 *  - Bits 04 - 00: Cache Type Field.
-		 * 	0 = Null - No more caches.
-		 * 	1 = Data Cache.
-		 * 	2 = Instruction Cache.
-		 * 	3 = Unified Cache.
-		 * 	4-31 = Reserved.
-		 *  - Bits 07 - 05: Cache Level (starts at 1).
-		 *  - Bit  08: does not need SW initialization.
-		 *  - 09: Fully Associative cache.
-		 */
-		if (!(type = eax & 0x00000001F))
-			break;
-		level = (eax >>= 5) & 0x00000007;
-		self_init = ((eax >>= 3) & 0x00000001);
-		fully_associative = ((eax >>= 1) & 0x00000001);
-		/*
-		 * Process contents of register EBX.
-		 * - Bits 11 - 00: L = System Coherency Line Size**.
-		 * - Bits 21 - 12: P = Physical Line partitions**.
-		 * - Bits 31 - 22: W = Ways of associativity**.
-		 */
-		line_size = (ebx & 0x00000FFF) + 1;
-		line_partitions = ((ebx >>= 12) & 0x000003FF) + 1;
-		ways = ((ebx >>= 10) & 0x000003FF) + 1;
-		/*
-		 * Process contents of register ECX.
-		 * - Bits 31-00: S = Number of Sets**.
-		 */
-		sets = ecx + 1;
-		/*
-		 * Process contents of register EDX.
-		 * - Bit 00: Write-Back Invalidate/Invalidate.
-		 * - Bit 01: Cache Inclusiveness.
-		 * - Bit 02: Complex Cache Indexing.
-		 */
-		wbinvd = ((edx & 0x00000001));
-		inclusive =((edx & 0x00000002));
-		indexing =((edx & 0x00000004));
-
-		total_size = ways * line_partitions * line_size * sets;
+		total_size = c->size;
 		prefix = " ";
 		bytes_to_prefix(&total_size, &prefix);
 		fprintf(stdout, "%2s%u%s %8s %6u %8u %8u %8u%s %8zu%s "
 				"%4s %6s %6s\n",
-				"L", level, self_init ? "*": "",
-				cache_type[type - 1], sets, line_size,
-				line_partitions, ways,
-				fully_associative ? "*": "",
+				"L", c->level, c->self_init ? "*": "",
+				cache_type[c->type - 1], c->sets, c->line_size,
+				c->line_partitions, c->ways,
+				c->fully_associative ? "*": "",
 				total_size, prefix,
-				wbinvd ? "N": "Y",
-				inclusive ? "N": "Y",
-				indexing ? "D": "C");
-		index++;
-	} while (1);
+				c->wbinvd ? "N": "Y",
+				c->inclusive ? "N": "Y",
+				c->complex_indexing ? "D": "C");
+	}
+}
+
+static void enumerate_features(void)
+{
+	uint64_t xcr0 = cpu_xcr0();
+	int f;
+
+	fprintf(stdout, "\n%-14s %5s %4s\n", "Feature", "CPUID", "OS");
+	for (f = 0; f < CPU_NFEATURES; f++) {
+		bool reported = cpu_reports(f);
+
+		fprintf(stdout, "%-14s %5s %4s\n", cpu_feature_name(f),
+			reported ? "Y" : "N",
+			!reported ? "-" : cpu_has(f) ? "Y" : "N");
+	}
+	fprintf(stdout, "\nXCR0 %#llx:%s%s%s%s%s%s%s\n",
+		(unsigned long long)xcr0,
+		xcr0 & XCR0_SSE ? " sse" : "", xcr0 & XCR0_AVX ? " avx" : "",
+		xcr0 & XCR0_OPMASK ? " opmask" : "",
+		xcr0 & XCR0_ZMM_HI256 ? " zmm_hi256" : "",
+		xcr0 & XCR0_HI16_ZMM ? " hi16_zmm" : "",
+		xcr0 & XCR0_TILECFG ? " tilecfg" : "",
+		xcr0 & XCR0_TILEDATA ? " tiledata" : "");
+	fprintf(stdout, "Kernels dispatch to: %s\n", isa_names[isa_level()]);
 }
 
 int main(void)
@@ -227,5 +215,6 @@ err_out:
 #error "Unsupported arch!"
 #endif
 	enumerate_cache();
+	enumerate_features();
 	return 0;
 }
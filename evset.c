@@ -0,0 +1,301 @@
+/*
+ * evset.c	- eviction sets: groups of lines that map to the same set of
+ * 		  a cache level.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Reference:
+ *	P. Vila, B. Köpf, J. F. Morales, "Theory and Practice of Finding
+ *	Eviction Sets", IEEE S&P 2019 (group testing reduction).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "evset.h"
+#include "pagemap.h"
+
+#define HUGE_PAGE_SIZE	(2UL << 20)
+#define EVICT_TRIES	5
+#define EVICT_BACKTRACKS	32
+#define EVICT_CAL	31
+#define MAX_CAND	8192
+
+int evpool_init(struct evpool *p, size_t size)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t i, npages;
+
+	memset(p, 0, sizeof(*p));
+	size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	p->base = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+	if (p->base != MAP_FAILED) {
+		p->hugetlb = true;
+		p->page_size = HUGE_PAGE_SIZE;
+	} else {
+		p->base = mmap(NULL, size, prot, flags, -1, 0);
+		if (p->base == MAP_FAILED)
+			return -1;
+		p->page_size = getpagesize();
+	}
+	p->size = size;
+	/*
+	 * Write, not read, every page: reads would all be backed by the one
+	 * shared zero page.
+	 */
+	for (i = 0; i < size; i += p->page_size)
+		p->base[i] = 1;
+
+	npages = size / p->page_size;
+	if (!(p->pa = malloc(npages * sizeof(*p->pa))))
+		goto err;
+	for (i = 0; i < npages; i++) {
+		p->pa[i] = virt_to_phys(p->base + i * p->page_size);
+		if (!p->pa[i]) {
+			free(p->pa);
+			p->pa = NULL;
+			break;
+		}
+	}
+	return 0;
+err:
+	munmap(p->base, size);
+	errno = ENOMEM;
+	return -1;
+}
+
+void evpool_destroy(struct evpool *p)
+{
+	free(p->pa);
+	munmap(p->base, p->size);
+	memset(p, 0, sizeof(*p));
+}
+
+bool evset_index_known(const struct evpool *p, const struct cache_info *c)
+{
+	return p->pa || (size_t)c->sets * c->line_size <= p->page_size;
+}
+
+unsigned long evset_index(const struct evpool *p, const struct cache_info *c,
+			  const uint8_t *addr)
+{
+	size_t off = addr - p->base;
+	uint64_t a;
+
+	if (p->pa)
+		a = p->pa[off / p->page_size] + off % p->page_size;
+	else
+		a = (uintptr_t)addr;
+	return (a / c->line_size) % c->sets;
+}
+
+int evset_collect(const struct evpool *p, const struct cache_info *c,
+		  unsigned long set, const struct cache_info *skip,
+		  unsigned long skip_set, uint8_t **out, int max)
+{
+	size_t off;
+	int n = 0;
+
+	for (off = 0; off < p->size && n < max; off += c->line_size) {
+		uint8_t *line = p->base + off;
+
+		if (evset_index(p, c, line) != set)
+			continue;
+		if (skip && evset_index(p, skip, line) == skip_set)
+			continue;
+		out[n++] = line;
+	}
+	return n;
+}
+
+void evset_traverse(uint8_t *const *set, int n, int reps)
+{
+	int i;
+
+	while (reps--)
+		for (i = 0; i < n; i++)
+			maccess(set[i]);
+}
+
+bool evset_evicts(const uint8_t *x, uint8_t *const *set, int n,
+		  unsigned threshold)
+{
+	int i, evicted = 0;
+
+	for (i = 0; i < EVICT_TRIES; i++) {
+		maccess(x);
+		evset_traverse(set, n, 2);
+		tlb_warm(x);
+		if (access_latency(x) > threshold)
+			evicted++;
+	}
+	return evicted > EVICT_TRIES / 2;
+}
+
+int evset_reduce(const uint8_t *x, uint8_t **cand, int n, int ways,
+		 unsigned threshold)
+{
+	uint8_t **perm;
+	int *history;
+	int g, i, depth = 0, backtracks = 0;
+	unsigned seed = n;
+
+	if (!evset_evicts(x, cand, n, threshold))
+		return -1;
+	perm = malloc(n * sizeof(*perm));
+	history = malloc(n * sizeof(*history));
+	if (!perm || !history) {
+		n = -1;
+		goto out;
+	}
+	/*
+	 * Split the candidates in @ways + 1 groups: at least one of them holds
+	 * no line of a minimal eviction set and can be dropped. Dropped groups
+	 * are kept right after the first @n candidates, so a wrong decision
+	 * caused by noise can be undone by growing @n back.
+	 */
+	while (n > ways) {
+		int chunk = (n + ways) / (ways + 1);
+		bool dropped = false;
+
+		for (g = 0; g * chunk < n; g++) {
+			int lo = g * chunk;
+			int hi = lo + chunk < n ? lo + chunk : n;
+			int m = 0;
+
+			for (i = 0; i < n; i++)
+				if (i < lo || i >= hi)
+					perm[m++] = cand[i];
+			if (!evset_evicts(x, perm, m, threshold))
+				continue;
+			for (i = lo; i < hi; i++)
+				perm[m + i - lo] = cand[i];
+			memcpy(cand, perm, n * sizeof(*cand));
+			history[depth++] = n;
+			n = m;
+			dropped = true;
+			break;
+		}
+		if (dropped)
+			continue;
+		if (!depth || ++backtracks > EVICT_BACKTRACKS) {
+			n = -1;
+			break;
+		}
+		n = history[--depth];
+		evset_shuffle(cand, n, &seed);
+	}
+out:
+	free(perm);
+	free(history);
+	return n;
+}
+
+void evset_shuffle(uint8_t **set, int n, unsigned *seed)
+{
+	int i;
+
+	for (i = n - 1; i > 0; i--) {
+		int j = rand_r(seed) % (i + 1);
+		uint8_t *t = set[i];
+
+		set[i] = set[j];
+		set[j] = t;
+	}
+}
+
+static int build_indexed(const struct evpool *p, const struct cache_info *c,
+			 const struct cache_info *above, uint8_t **cong,
+			 int max, uint8_t **upper, int *nupper, int max_upper,
+			 unsigned *seed)
+{
+	unsigned long set = evset_index(p, c, p->base);
+	int n;
+
+	n = evset_collect(p, c, set, NULL, 0, cong, max);
+	evset_shuffle(cong, n, seed);
+	*nupper = 0;
+	if (above && n) {
+		*nupper = evset_collect(p, above, evset_index(p, above, cong[0]),
+					c, set, upper, max_upper);
+		evset_shuffle(upper, *nupper, seed);
+	}
+	return n;
+}
+
+/*
+ * Sliced level: the lines sharing the set of the level above are the
+ * candidates. Reduce them to a minimal eviction set for the first one, then
+ * sort the rest by whether that set evicts them.
+ */
+static int build_sliced(const struct evpool *p, const struct cache_info *c,
+			const struct cache_info *above, uint8_t **cong,
+			int max, uint8_t **upper, int *nupper, int max_upper,
+			unsigned *seed)
+{
+	unsigned hit[EVICT_CAL], miss[EVICT_CAL], threshold;
+	uint8_t **cand, *x;
+	int n, m, i, ncong = 0;
+
+	*nupper = 0;
+	if (!(cand = malloc(MAX_CAND * sizeof(*cand))))
+		return -1;
+	n = evset_collect(p, above, evset_index(p, above, p->base), NULL, 0,
+			  cand, MAX_CAND);
+	if (n < 4 * (int)above->ways) {
+		ncong = -1;
+		goto out;
+	}
+	evset_shuffle(cand, n, seed);
+	x = cand[0];
+	/* Hit in this level after the level above is thrashed, or memory. */
+	for (i = 0; i < EVICT_CAL; i++) {
+		maccess(x);
+		evset_traverse(cand + 1, 2 * above->ways, 2);
+		tlb_warm(x);
+		hit[i] = access_latency(x);
+		clflush(x);
+		asm volatile ("mfence" ::: "memory");
+		tlb_warm(x);
+		miss[i] = access_latency(x);
+	}
+	threshold = (median(hit, EVICT_CAL) + median(miss, EVICT_CAL)) / 2;
+
+	m = evset_reduce(x, cand + 1, n - 1, c->ways, threshold);
+	if (m < (int)c->ways) {
+		ncong = -1;
+		goto out;
+	}
+	cong[ncong++] = x;
+	for (i = 1; i <= m && ncong < max; i++)
+		cong[ncong++] = cand[i];
+	for (i = m + 1; i < n && ncong < max; i++) {
+		if (evset_evicts(cand[i], cand + 1, m, threshold))
+			cong[ncong++] = cand[i];
+		else if (*nupper < max_upper)
+			upper[(*nupper)++] = cand[i];
+	}
+	evset_shuffle(cong, ncong, seed);
+out:
+	free(cand);
+	return ncong;
+}
+
+int evset_build(const struct evpool *p, const struct cache_info *c,
+		const struct cache_info *above, uint8_t **cong, int max,
+		uint8_t **upper, int *nupper, int max_upper, unsigned *seed)
+{
+	*nupper = 0;
+	if (c->complex_indexing && above && p->pa)
+		return build_sliced(p, c, above, cong, max, upper, nupper,
+				    max_upper, seed);
+	if (!c->complex_indexing && evset_index_known(p, c))
+		return build_indexed(p, c, above, cong, max, upper, nupper,
+				     max_upper, seed);
+	return -1;
+}
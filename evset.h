@@ -0,0 +1,87 @@
+/*
+ * evset.h	- eviction sets: groups of lines that map to the same set of
+ * 		  a cache level.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef EVSET_H
+#define EVSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cacheinfo.h"
+
+/* A faulted-in buffer the eviction sets are carved out of. */
+struct evpool {
+	uint8_t *base;
+	size_t size;
+	size_t page_size;
+	bool hugetlb;			/* backed by hugetlbfs pages */
+	uint64_t *pa;			/* physical address per page, or NULL */
+};
+
+/*
+ * Map and fault in @size bytes, on 2M hugetlb pages if the system has
+ * some, and record the physical address of each page when pagemap lets us.
+ * Returns 0 or -1 with errno set.
+ */
+int evpool_init(struct evpool *p, size_t size);
+void evpool_destroy(struct evpool *p);
+
+/*
+ * True if the set index of cache @c can be computed for lines of @p, i.e.
+ * physical addresses are known or the index bits fall within a page. Slice
+ * hashing (complex indexing) is not accounted for.
+ */
+bool evset_index_known(const struct evpool *p, const struct cache_info *c);
+
+/* Set index of @addr in @c, see evset_index_known(). */
+unsigned long evset_index(const struct evpool *p, const struct cache_info *c,
+			  const uint8_t *addr);
+
+/*
+ * Store up to @max lines of @p mapping to @set of @c in @out, leaving out
+ * the lines that map to @skip_set of @skip (when @skip is not NULL).
+ * Returns how many were found.
+ */
+int evset_collect(const struct evpool *p, const struct cache_info *c,
+		  unsigned long set, const struct cache_info *skip,
+		  unsigned long skip_set, uint8_t **out, int max);
+
+/* Load the @n lines of @set, @reps times over. */
+void evset_traverse(uint8_t *const *set, int n, int reps);
+
+/*
+ * True if loading @x, then traversing the @n lines of @set leaves @x slower
+ * to load than @threshold cycles, in the majority of a few tries.
+ */
+bool evset_evicts(const uint8_t *x, uint8_t *const *set, int n,
+		  unsigned threshold);
+
+/*
+ * Reduce the @n candidates in @cand, which must evict @x, to a minimal
+ * eviction set of @ways lines by group testing; the result is left at the
+ * front of @cand. Returns its size, or -1 if the candidates do not evict @x
+ * (or stop doing so because of noise).
+ */
+int evset_reduce(const uint8_t *x, uint8_t **cand, int n, int ways,
+		 unsigned threshold);
+
+/*
+ * Pick a set of @c and store up to @max lines of @p congruent in it in
+ * @cong, shuffled, and up to @max_upper lines in @upper that share their set
+ * of @above (when not NULL) but not the one of @c: loading those evicts the
+ * congruent lines from the levels above @c only. A complex indexed @c needs
+ * physical addresses and @above, and is reduced by timing. Returns the
+ * number of congruent lines (@nupper gets the other count) or -1.
+ */
+int evset_build(const struct evpool *p, const struct cache_info *c,
+		const struct cache_info *above, uint8_t **cong, int max,
+		uint8_t **upper, int *nupper, int max_upper, unsigned *seed);
+
+/* Shuffle @n lines, so that walking them has no constant stride. */
+void evset_shuffle(uint8_t **set, int n, unsigned *seed);
+
+#endif /* EVSET_H */
@@ -0,0 +1,212 @@
+/*
+ * fences.c	- cost of memory fences and serializing instructions, alone
+ * 		  and with stores or a load miss in flight.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Each instruction runs in a loop in three settings:
+ *
+ *	alone	back to back, nothing in flight but the loop itself
+ *	stores	after four stores to lines not written for a while, which
+ *		are still in the store buffer when the instruction comes
+ *	miss	after an independent load from a random line of 4 times the
+ *		LLC, still outstanding when the instruction comes
+ *
+ * The cost is TSC cycles per iteration beyond the same loop without the
+ * instruction, best of a few runs. mfence, a locked or to the stack and
+ * xchg with memory drain the store buffer; lfence waits for earlier loads
+ * to complete but not for stores; sfence only orders stores against each
+ * other; cpuid and serialize wait for everything. The difference between
+ * the columns is what each of them waits for in practice. Under a
+ * hypervisor cpuid exits to it, which costs thousands of cycles.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "cpufeature.h"
+
+#define FE_ITERS	(1 << 14)
+#define FE_TRIES	5
+#define FE_MIN		MEGABYTES(64)
+#define FE_MAX		MEGABYTES(512)
+
+enum fe_insn {
+	FE_NONE, FE_MFENCE, FE_SFENCE, FE_LFENCE, FE_LOCK_OR, FE_XCHG,
+	FE_CPUID, FE_SERIALIZE, FE_NINSNS
+};
+
+enum fe_ctx { FE_ALONE, FE_STORES, FE_MISS, FE_NCTXS };
+
+static const char *const fe_names[FE_NINSNS] = {
+	"none", "mfence", "sfence", "lfence", "lock or", "xchg", "cpuid",
+	"serialize",
+};
+
+static const char *const fe_ctxs[FE_NCTXS] = {
+	"alone", "stores", "miss",
+};
+
+static inline __attribute__((always_inline)) void fence(enum fe_insn insn)
+{
+	uint64_t word = 0;
+	uint32_t a = 0, b, c = 0, d;
+
+	switch (insn) {
+	case FE_MFENCE:
+		asm volatile ("mfence" ::: "memory");
+		break;
+	case FE_SFENCE:
+		asm volatile ("sfence" ::: "memory");
+		break;
+	case FE_LFENCE:
+		asm volatile ("lfence" ::: "memory");
+		break;
+	case FE_LOCK_OR:
+		asm volatile ("lock orq $0, (%%rsp)" ::: "memory");
+		break;
+	case FE_XCHG:
+		asm volatile ("xchg %0, %1" : "+r"(word), "+m"(word) ::
+			      "memory");
+		break;
+	case FE_CPUID:
+		asm volatile ("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d) ::
+			      "memory");
+		break;
+	case FE_SERIALIZE:
+		/* serialize, spelled out for older assemblers. */
+		asm volatile (".byte 0x0f, 0x01, 0xe8" ::: "memory");
+		break;
+	default:
+		/* Keeps the empty loop of FE_NONE. */
+		asm volatile ("" ::: "memory");
+		break;
+	}
+}
+
+/*
+ * TSC cycles of FE_ITERS iterations of @insn in @ctx. The store lines
+ * advance through @buf, the miss lines are picked at random from it.
+ */
+static inline __attribute__((always_inline))
+uint64_t fence_loop(enum fe_insn insn, enum fe_ctx ctx, uint8_t *buf,
+		    size_t size)
+{
+	static size_t head;
+	size_t lines = size / 64, i;
+	uint64_t x = 0x9e3779b97f4a7c15ULL, sum = 0, t0, t;
+
+	t0 = tsc_start();
+	switch (ctx) {
+	case FE_ALONE:
+		for (i = 0; i < FE_ITERS; i++)
+			fence(insn);
+		break;
+	case FE_STORES:
+		for (i = 0; i < FE_ITERS; i++) {
+			uint8_t *p = buf + head;
+
+			*(volatile uint64_t *)p = i;
+			*(volatile uint64_t *)(p + 64) = i;
+			*(volatile uint64_t *)(p + 128) = i;
+			*(volatile uint64_t *)(p + 192) = i;
+			head = head + 256 < size ? head + 256 : 0;
+			fence(insn);
+		}
+		break;
+	case FE_MISS:
+		for (i = 0; i < FE_ITERS; i++) {
+			x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+			sum += *(volatile uint64_t *)(buf + (x >> 24) % lines *
+						      64);
+			fence(insn);
+		}
+		break;
+	default:
+		break;
+	}
+	t = tsc_stop() - t0;
+	asm volatile ("" :: "r"(sum));
+	return t;
+}
+
+#define FE_CASE(insn)	case insn: return fence_loop(insn, ctx, buf, size)
+
+static uint64_t fence_cycles(enum fe_insn insn, enum fe_ctx ctx,
+			     uint8_t *buf, size_t size)
+{
+	switch (insn) {
+	FE_CASE(FE_NONE);
+	FE_CASE(FE_MFENCE);
+	FE_CASE(FE_SFENCE);
+	FE_CASE(FE_LFENCE);
+	FE_CASE(FE_LOCK_OR);
+	FE_CASE(FE_XCHG);
+	FE_CASE(FE_CPUID);
+	FE_CASE(FE_SERIALIZE);
+	default:
+		return 0;
+	}
+}
+
+/* Best cycles per iteration of @insn in @ctx. */
+static double per_iter(enum fe_insn insn, enum fe_ctx ctx, uint8_t *buf,
+		       size_t size)
+{
+	uint64_t best = 0;
+	int t;
+
+	for (t = 0; t < FE_TRIES; t++) {
+		uint64_t c = fence_cycles(insn, ctx, buf, size);
+
+		if (!t || c < best)
+			best = c;
+	}
+	return (double)best / FE_ITERS;
+}
+
+void fences_benchmark(void)
+{
+	size_t llc = cache_level_size(3), size;
+	double base[FE_NCTXS];
+	uint8_t *buf;
+	unsigned k, c;
+
+	if (!llc)
+		llc = cache_level_size(2);
+	size = 4 * llc < FE_MAX ? 4 * llc : FE_MAX;
+	if (size < FE_MIN)
+		size = FE_MIN;
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap()");
+	memset(buf, 1, size);
+
+	fprintf(stdout, "\nFences and serializing instructions, TSC cycles "
+		"beyond the loop without one\n Instruction");
+	for (c = 0; c < FE_NCTXS; c++)
+		fprintf(stdout, " %9s", fe_ctxs[c]);
+	fputc('\n', stdout);
+	for (c = 0; c < FE_NCTXS; c++)
+		base[c] = per_iter(FE_NONE, c, buf, size);
+	fprintf(stdout, " %-11s", "(loop)");
+	for (c = 0; c < FE_NCTXS; c++)
+		fprintf(stdout, " %9.1f", base[c]);
+	fputc('\n', stdout);
+	for (k = FE_NONE + 1; k < FE_NINSNS; k++) {
+		fprintf(stdout, " %-11s", fe_names[k]);
+		if (k == FE_SERIALIZE && !cpu_has(CPU_SERIALIZE)) {
+			fprintf(stdout, " %9s %9s %9s\n", "-", "-", "-");
+			continue;
+		}
+		for (c = 0; c < FE_NCTXS; c++)
+			fprintf(stdout, " %9.1f",
+				per_iter(k, c, buf, size) - base[c]);
+		fputc('\n', stdout);
+	}
+	munmap(buf, size);
+}
@@ -0,0 +1,323 @@
+/*
+ * flush.c	- cost of writing back and invalidating caches: wbinvd by
+ * 		  footprint through the read-cr0 module, and clflush,
+ * 		  clflushopt and clwb over ranges from user space.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * wbinvd is privileged, so it is timed by the module's runner in
+ * /sys/kernel/debug/cache_bench (CB_WBINVD_DIRTY/CLEAN, see
+ * read-cr0/cache_bench.c) after writing or reading a footprint of the
+ * buffer; with nothing dirty it is the cost of walking the caches alone.
+ *
+ * The line flushes run here, over ranges from one line to 64 MB that are
+ * either dirty (written just before) or clean (read just before, after the
+ * whole buffer was flushed once). clflushopt and clwb are only ordered by
+ * a fence, so each range ends with an sfence, timed too: it waits for the
+ * write backs to finish. The result is TSC cycles per line, what a commit
+ * of that many lines to persistent memory costs at least.
+ *
+ * The log appends then do what a log-structured writer does: write a
+ * record at the head of a 64 MB log, flush its lines and fence, with the
+ * fence after every line, after every record, or after a group of 16
+ * records (group commit). Throughput is MB/s of records made durable over
+ * 16 MB of log, timed around the whole log only; latency is the median TSC
+ * cycles from the first store of a record, or of the first record of a
+ * group, until the fence that covers it retires, in a second pass over the
+ * log. That is when the flushes are ordered before later stores, not
+ * necessarily when the lines reached the persistence domain, so it is a
+ * lower bound on the latency to durability.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "cbench.h"
+#include "cpufeature.h"
+#include "util.h"
+
+#define FL_SAMPLES	11
+#define FL_MAX		MEGABYTES(64)
+#define FL_LINES	(1 << 16)	/* lines flushed per size, at least */
+#define FL_TRIES	5
+#define FL_LOG_BYTES	MEGABYTES(16)	/* appended per log run */
+#define FL_GROUP	16		/* records per group commit */
+
+enum fl_insn { FL_CLFLUSH, FL_CLFLUSHOPT, FL_CLWB, FL_NINSNS };
+
+static const char *const fl_names[FL_NINSNS] = {
+	"clflush", "clflushopt", "clwb",
+};
+
+enum fl_fence { FL_FENCE_LINE, FL_FENCE_RECORD, FL_FENCE_GROUP, FL_NFENCES };
+
+static const char *const fl_fences[FL_NFENCES] = {
+	"per line", "per record", "per 16 records",
+};
+
+static const size_t fl_records[] = { 64, 256, 1024, 4096, 65536 };
+#define FL_NRECORDS	(sizeof(fl_records) / sizeof(fl_records[0]))
+
+static void wbinvd_cost(void)
+{
+	size_t llc = cache_level_size(3), size;
+
+	if (!llc)
+		llc = cache_level_size(2);
+	fprintf(stdout, "\nwbinvd, median TSC cycles after writing (dirty) or "
+		"reading (clean) a footprint\n");
+	if (!cbench_available()) {
+		fprintf(stdout, " %s not found, load read-cr0/rcr0.ko and mount "
+			"debugfs\n", CBENCH_DIR);
+		return;
+	}
+	fprintf(stdout, " Footprint        dirty        clean\n");
+	for (size = KILOBYTES(4); size <= CBENCH_MAX && size <= 4 * llc;
+	     size <<= 2) {
+		struct cbench_spread d, c;
+
+		if (cbench_run(CB_WBINVD_DIRTY, size, 0, FL_SAMPLES, &d) ||
+		    cbench_run(CB_WBINVD_CLEAN, size, 0, FL_SAMPLES, &c))
+			die(CBENCH_DIR);
+		fprintf(stdout, " %8zuK %12llu %12llu\n", size >> 10,
+			d.median, c.median);
+	}
+}
+
+static void flush_range(enum fl_insn insn, uint8_t *buf, size_t size,
+			unsigned line)
+{
+	size_t i;
+
+	switch (insn) {
+	case FL_CLFLUSH:
+		for (i = 0; i < size; i += line)
+			asm volatile ("clflush (%0)" :: "r"(buf + i) : "memory");
+		break;
+	case FL_CLFLUSHOPT:
+		for (i = 0; i < size; i += line)
+			asm volatile ("clflushopt (%0)" :: "r"(buf + i) :
+				      "memory");
+		break;
+	case FL_CLWB:
+		for (i = 0; i < size; i += line)
+			asm volatile ("clwb (%0)" :: "r"(buf + i) : "memory");
+		break;
+	default:
+		break;
+	}
+	asm volatile ("sfence" ::: "memory");
+}
+
+static inline void flush_line(enum fl_insn insn, uint8_t *p)
+{
+	switch (insn) {
+	case FL_CLFLUSH:
+		asm volatile ("clflush (%0)" :: "r"(p) : "memory");
+		break;
+	case FL_CLFLUSHOPT:
+		asm volatile ("clflushopt (%0)" :: "r"(p) : "memory");
+		break;
+	case FL_CLWB:
+		asm volatile ("clwb (%0)" :: "r"(p) : "memory");
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Write record @r of @record bytes at @rec and flush it with @insn, with
+ * the fences of @fence. Returns true if a fence now covers it, and the
+ * records of its group.
+ */
+static inline bool append(enum fl_insn insn, enum fl_fence fence,
+			  uint8_t *rec, size_t record, unsigned line, size_t r,
+			  bool last)
+{
+	size_t i;
+
+	for (i = 0; i < record; i += 8)
+		*(volatile uint64_t *)(rec + i) = r + i;
+	for (i = 0; i < record; i += line) {
+		flush_line(insn, rec + i);
+		if (fence == FL_FENCE_LINE)
+			asm volatile ("sfence" ::: "memory");
+	}
+	if (fence == FL_FENCE_GROUP && r % FL_GROUP != FL_GROUP - 1 && !last)
+		return false;
+	if (fence != FL_FENCE_LINE)
+		asm volatile ("sfence" ::: "memory");
+	return true;
+}
+
+/*
+ * Append FL_LOG_BYTES of @record byte records to the log @buf[0, @size)
+ * with @insn and @fence, and return MB/s. Nothing but the appends is in
+ * the loop: a time stamp per record would add its own ordering to every
+ * record, and weigh most on the fences that are not grouped.
+ */
+static double log_rate(enum fl_insn insn, enum fl_fence fence, uint8_t *buf,
+		       size_t size, size_t record, unsigned line)
+{
+	size_t records = FL_LOG_BYTES / record, head = 0, r;
+	double start = now_ns();
+
+	for (r = 0; r < records; r++) {
+		append(insn, fence, buf + head, record, line, r,
+		       r == records - 1);
+		head = head + record < size ? head + record : 0;
+	}
+	return records * record / (now_ns() - start) * 1e3;
+}
+
+/*
+ * The same appends again, in a pass of their own, for the median TSC
+ * cycles from the first store of a record (or group) until the fence that
+ * covers it retires. The first stamp is tsc_read(), which adds no fence of
+ * its own; the second is tsc_stop(): its rdtscp waits for the sfence, and
+ * its lfence keeps the next record from starting before the stamp is read.
+ * @lat has room for every record.
+ */
+static unsigned log_latency(enum fl_insn insn, enum fl_fence fence,
+			    uint8_t *buf, size_t size, size_t record,
+			    unsigned line, unsigned *lat)
+{
+	size_t records = FL_LOG_BYTES / record, head = 0, r;
+	uint64_t t0 = 0;
+	int n = 0;
+
+	for (r = 0; r < records; r++) {
+		if (fence != FL_FENCE_GROUP || !(r % FL_GROUP))
+			t0 = tsc_read();
+		if (append(insn, fence, buf + head, record, line, r,
+			   r == records - 1))
+			lat[n++] = tsc_stop() - t0;
+		head = head + record < size ? head + record : 0;
+	}
+	return median(lat, n);
+}
+
+/* The log appends, for every record size, instruction and fence. */
+static void log_cost(const bool *has, uint8_t *buf, unsigned line)
+{
+	unsigned *lat, k, f, s;
+
+	if (!(lat = malloc(FL_LOG_BYTES / fl_records[0] * sizeof(*lat))))
+		die("malloc()");
+	flush_range(FL_CLFLUSH, buf, FL_MAX, line);
+	fprintf(stdout, "\nLog appends (record, flush, fence), MB/s and "
+		"median TSC cycles until the fence retires\n  Record %-10s",
+		"");
+	for (f = 0; f < FL_NFENCES; f++)
+		fprintf(stdout, " %17s", fl_fences[f]);
+	fputc('\n', stdout);
+	for (s = 0; s < FL_NRECORDS; s++) {
+		for (k = 0; k < FL_NINSNS; k++) {
+			if (fl_records[s] < KILOBYTES(1))
+				fprintf(stdout, " %6zuB", fl_records[s]);
+			else
+				fprintf(stdout, " %6zuK", fl_records[s] >> 10);
+			fprintf(stdout, " %-10s", fl_names[k]);
+			for (f = 0; f < FL_NFENCES; f++) {
+				size_t rec = fl_records[s];
+
+				if (!has[k]) {
+					fprintf(stdout, " %8s %8s", "-", "-");
+					continue;
+				}
+				fprintf(stdout, " %8.0f",
+					log_rate(k, f, buf, FL_MAX, rec, line));
+				fprintf(stdout, " %8u", log_latency(k, f, buf,
+					FL_MAX, rec, line, lat));
+			}
+			fputc('\n', stdout);
+		}
+	}
+	free(lat);
+}
+
+/*
+ * Cycles per line to flush @size bytes of @buf with @insn, the lines
+ * written (@dirty) or read right before. Small ranges are repeated to
+ * flush FL_LINES lines in all; best of FL_TRIES.
+ */
+static double line_cost(enum fl_insn insn, uint8_t *buf, size_t size,
+			unsigned line, bool dirty)
+{
+	size_t lines = size / line, reps = (FL_LINES + lines - 1) / lines, i, r;
+	double best = 0;
+	int t;
+
+	for (t = 0; t < FL_TRIES; t++) {
+		uint64_t cycles = 0;
+
+		for (r = 0; r < reps; r++) {
+			uint64_t t0;
+
+			for (i = 0; i < size; i += line) {
+				if (dirty)
+					(*(volatile uint64_t *)(buf + i))++;
+				else
+					maccess(buf + i);
+			}
+			t0 = tsc_start();
+			flush_range(insn, buf, size, line);
+			cycles += tsc_stop() - t0;
+		}
+		if (!t || (double)cycles / (reps * lines) < best)
+			best = (double)cycles / (reps * lines);
+	}
+	return best;
+}
+
+void flush_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	unsigned line = cache_line_size();
+	bool has[FL_NINSNS] = { true };
+	uint8_t *buf;
+	size_t size;
+	int k;
+
+	wbinvd_cost();
+
+	has[FL_CLFLUSHOPT] = cpu_has(CPU_CLFLUSHOPT);
+	has[FL_CLWB] = cpu_has(CPU_CLWB);
+
+	buf = mmap(NULL, FL_MAX, prot, flags, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap()");
+	memset(buf, 1, FL_MAX);
+	flush_range(FL_CLFLUSH, buf, FL_MAX, line);
+
+	fprintf(stdout, "\nLine flushes, TSC cycles per line including the "
+		"final sfence (dirty/clean)\n     Range");
+	for (k = 0; k < FL_NINSNS; k++)
+		fprintf(stdout, " %19s", fl_names[k]);
+	fputc('\n', stdout);
+	for (size = line; size <= FL_MAX; size <<= 2) {
+		if (size < KILOBYTES(1))
+			fprintf(stdout, " %8zuB", size);
+		else
+			fprintf(stdout, " %8zuK", size >> 10);
+		for (k = 0; k < FL_NINSNS; k++) {
+			if (!has[k]) {
+				fprintf(stdout, " %19s", "-");
+				continue;
+			}
+			fprintf(stdout, " %9.1f %9.1f",
+				line_cost(k, buf, size, line, true),
+				line_cost(k, buf, size, line, false));
+		}
+		fputc('\n', stdout);
+	}
+	log_cost(has, buf, line);
+	munmap(buf, FL_MAX);
+}
@@ -0,0 +1,377 @@
+/*
+ * gather.c	- hardware gathers against scalar loads for random access to
+ * 		  a table, by element width, index locality and table size.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The kernel is dictionary decoding reduced to its loads: sum the table
+ * elements an array of 32-bit indices points at. It comes in three
+ * implementations, scalar loads, AVX2 (vpgatherdd for 32-bit elements,
+ * vpgatherdq for 64-bit ones) and AVX-512 (the same on 16 and 8 lanes), and
+ * the vector ones run only up to isa_level(). The indices are:
+ *
+ *	seq	consecutive, every element of every line used
+ *	page	random within a 4 KB window that moves along the table, as
+ *		in sorted or clustered codes
+ *	random	uniform over the whole table
+ *
+ * Tables go from 16 KB to 4 times the LLC (at least 64 MB, at most 512 MB),
+ * so that each cache level and memory is crossed. The index array is as
+ * long as the table has elements (4K to 4M of them) and is walked again
+ * until 4M elements were summed, best of three runs; past 4M elements the
+ * lines of seq and the windows of page are spread over the whole table.
+ * Below each table the size ranges in which a gather beats scalar loads by
+ * more than 5% are listed: their ends are the crossover points.
+ */
+#define _GNU_SOURCE
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "cpufeature.h"
+#include "trace.h"
+#include "util.h"
+
+#define GA_ELEMENTS	(1 << 22)	/* summed per timing run */
+#define GA_MIN_IDX	(1 << 12)
+#define GA_TRIES	3
+#define GA_MIN		KILOBYTES(16)
+#define GA_MAX		MEGABYTES(512)
+#define GA_WINDOW	4096
+
+enum { GA_SEQ, GA_PAGE, GA_RANDOM, GA_NLOCALITIES };
+enum { GA_SCALAR, GA_AVX2, GA_AVX512, GA_NIMPLS };
+
+static const char *const ga_localities[GA_NLOCALITIES] = {
+	"seq", "page", "random",
+};
+
+typedef uint64_t (*gather_fn)(const void *table, const uint32_t *idx,
+			      size_t n);
+
+struct impl {
+	const char *name;
+	gather_fn fn[2];		/* 32-bit, 64-bit elements */
+	enum isa needs;
+};
+
+static unsigned seed = 0x6a7;
+
+/*
+ * Record the load of @lanes indices at @idx and the loads of the elements of
+ * @width bytes they point at in @table, what one gather or @lanes scalar
+ * loads do.
+ */
+static inline void trace_gather(const void *table, const uint32_t *idx,
+				unsigned lanes, unsigned width)
+{
+#ifdef CONFIG_TRACE
+	unsigned j;
+
+	for (j = 0; j < lanes; j++) {
+		TRACE_LOAD(idx + j);
+		TRACE_LOAD((const uint8_t *)table + (size_t)idx[j] * width);
+	}
+#endif
+}
+
+static uint64_t scalar32(const void *table, const uint32_t *idx, size_t n)
+{
+	const uint32_t *t = table;
+	uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i;
+
+	for (i = 0; i < n; i += 4) {
+		trace_gather(table, idx + i, 4, sizeof(*t));
+		s0 += t[idx[i]];
+		s1 += t[idx[i + 1]];
+		s2 += t[idx[i + 2]];
+		s3 += t[idx[i + 3]];
+	}
+	return s0 + s1 + s2 + s3;
+}
+
+static uint64_t scalar64(const void *table, const uint32_t *idx, size_t n)
+{
+	const uint64_t *t = table;
+	uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t i;
+
+	for (i = 0; i < n; i += 4) {
+		trace_gather(table, idx + i, 4, sizeof(*t));
+		s0 += t[idx[i]];
+		s1 += t[idx[i + 1]];
+		s2 += t[idx[i + 2]];
+		s3 += t[idx[i + 3]];
+	}
+	return s0 + s1 + s2 + s3;
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_32(const void *table, const uint32_t *idx, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	uint32_t lanes[8];
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(idx + i));
+
+		trace_gather(table, idx + i, 8, 4);
+		acc = _mm256_add_epi32(acc,
+				       _mm256_i32gather_epi32(table, v, 4));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	for (i = 0; i < 8; i++)
+		sum += lanes[i];
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_64(const void *table, const uint32_t *idx, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	uint64_t lanes[4];
+	size_t i;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(idx + i));
+
+		trace_gather(table, idx + i, 4, 8);
+		acc = _mm256_add_epi64(acc,
+				       _mm256_i32gather_epi64(table, v, 8));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx512f")))
+static uint64_t avx512_32(const void *table, const uint32_t *idx, size_t n)
+{
+	__m512i acc = _mm512_setzero_si512();
+	size_t i;
+
+	for (i = 0; i < n; i += 16) {
+		__m512i v = _mm512_loadu_si512(idx + i);
+
+		trace_gather(table, idx + i, 16, 4);
+		acc = _mm512_add_epi32(acc,
+				       _mm512_i32gather_epi32(v, table, 4));
+	}
+	return (uint32_t)_mm512_reduce_add_epi32(acc);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t avx512_64(const void *table, const uint32_t *idx, size_t n)
+{
+	__m512i acc = _mm512_setzero_si512();
+	size_t i;
+
+	for (i = 0; i < n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(idx + i));
+
+		trace_gather(table, idx + i, 8, 8);
+		acc = _mm512_add_epi64(acc,
+				       _mm512_i32gather_epi64(v, table, 8));
+	}
+	return _mm512_reduce_add_epi64(acc);
+}
+
+static const struct impl impls[GA_NIMPLS] = {
+	[GA_SCALAR] = { "scalar", { scalar32, scalar64 }, ISA_SCALAR },
+	[GA_AVX2] = { "avx2", { avx2_32, avx2_64 }, ISA_AVX2 },
+	[GA_AVX512] = { "avx512", { avx512_32, avx512_64 }, ISA_AVX512 },
+};
+
+/*
+ * @n indices into a table of @elements elements of @width bytes. When the
+ * table has more elements than that, the lines of seq and the windows of
+ * page are spread evenly over it, @stride apart, so that all of it is used.
+ */
+static void make_indices(uint32_t *idx, size_t n, size_t elements,
+			 unsigned width, int locality)
+{
+	size_t window = GA_WINDOW / width, line = 64 / width, i;
+	size_t stride = elements > n ? elements / n : 1;
+
+	if (window > elements)
+		window = elements;
+	for (i = 0; i < n; i++) {
+		switch (locality) {
+		case GA_SEQ:
+			idx[i] = (i / line * line * stride + i % line) %
+				 elements;
+			break;
+		case GA_PAGE:
+			idx[i] = (i / window * window * stride) % elements +
+				rand_r(&seed) % window;
+			break;
+		default:
+			idx[i] = ((size_t)rand_r(&seed) * RAND_MAX +
+				  rand_r(&seed)) % elements;
+		}
+	}
+}
+
+/* M elements per second of @fn, best of a few runs. */
+static double rate(gather_fn fn, const void *table, const uint32_t *idx,
+		   size_t n)
+{
+	size_t passes = GA_ELEMENTS / n, p;
+	double best = 0;
+	uint64_t sum = 0;
+	int t;
+
+	if (!passes)
+		passes = 1;
+	for (t = 0; t < GA_TRIES; t++) {
+		double t0 = now_ns(), r;
+
+		for (p = 0; p < passes; p++)
+			sum += fn(table, idx, n);
+		r = n * passes / (now_ns() - t0) * 1e3;
+		if (r > best)
+			best = r;
+	}
+	asm volatile ("" :: "r"(sum));
+	return best;
+}
+
+static const char *level_of(size_t size)
+{
+	if (size <= cache_level_size(1))
+		return "L1";
+	if (size <= cache_level_size(2))
+		return "L2";
+	if (size <= cache_level_size(3))
+		return "L3";
+	return "mem";
+}
+
+/* "16K", "512M" */
+static const char *size_str(char *buf, size_t size)
+{
+	if (size < MEGABYTES(1))
+		sprintf(buf, "%zuK", size >> 10);
+	else
+		sprintf(buf, "%zuM", size >> 20);
+	return buf;
+}
+
+static void sweep(unsigned width, uint8_t *table, size_t max, uint32_t *idx)
+{
+	enum isa isa = isa_level();
+	bool wins[GA_NLOCALITIES][GA_NIMPLS][16] = { { { false } } };
+	size_t sizes[16], size;
+	char str[2][24];
+	int nsizes = 0, l, k, s;
+
+	for (size = GA_MIN; size < max && nsizes < 15; size <<= 2)
+		sizes[nsizes++] = size;
+	sizes[nsizes++] = max;
+
+	fprintf(stdout, "\nGather, %u-bit elements, M elements/s\n%11s",
+		width * 8, "");
+	for (l = 0; l < GA_NLOCALITIES; l++)
+		fprintf(stdout, "%24s", ga_localities[l]);
+	fprintf(stdout, "\n   Size    ");
+	for (l = 0; l < GA_NLOCALITIES; l++)
+		for (k = 0; k < GA_NIMPLS; k++)
+			fprintf(stdout, " %7s", impls[k].name);
+	fputc('\n', stdout);
+
+	for (s = 0; s < nsizes; s++) {
+		size_t elements = sizes[s] / width, n = elements;
+
+		if (n < GA_MIN_IDX)
+			n = GA_MIN_IDX;
+		if (n > GA_ELEMENTS)
+			n = GA_ELEMENTS;
+		fprintf(stdout, " %6s %-3s", size_str(str[0], sizes[s]),
+			level_of(sizes[s]));
+		for (l = 0; l < GA_NLOCALITIES; l++) {
+			double scalar = 0;
+
+			make_indices(idx, n, elements, width, l);
+			for (k = 0; k < GA_NIMPLS; k++) {
+				double r;
+
+				if (impls[k].needs > isa) {
+					fprintf(stdout, " %7s", "-");
+					continue;
+				}
+				r = rate(impls[k].fn[width == 8], table, idx,
+					 n);
+				if (k == GA_SCALAR)
+					scalar = r;
+				else
+					wins[l][k][s] = r > 1.05 * scalar;
+				fprintf(stdout, " %7.0f", r);
+			}
+		}
+		fputc('\n', stdout);
+	}
+
+	for (l = 0; l < GA_NLOCALITIES; l++) {
+		for (k = GA_SCALAR + 1; k < GA_NIMPLS; k++) {
+			bool any = false;
+
+			if (impls[k].needs > isa)
+				continue;
+			fprintf(stdout, " %-6s %-6s beats scalar:",
+				ga_localities[l], impls[k].name);
+			/* Runs of winning sizes, "16K-4M 256M". */
+			for (s = 0; s < nsizes; s++) {
+				int e = s;
+
+				if (!wins[l][k][s])
+					continue;
+				while (e + 1 < nsizes && wins[l][k][e + 1])
+					e++;
+				if (e > s)
+					fprintf(stdout, " %s-%s",
+						size_str(str[0], sizes[s]),
+						size_str(str[1], sizes[e]));
+				else
+					fprintf(stdout, " %s",
+						size_str(str[0], sizes[s]));
+				any = true;
+				s = e;
+			}
+			fprintf(stdout, "%s\n", any ? "" : " nowhere");
+		}
+	}
+}
+
+void gather_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	size_t llc = cache_level_size(3), max, i;
+	uint32_t *idx;
+	uint64_t *table;
+
+	if (!llc)
+		llc = cache_level_size(2);
+	max = 4 * llc < GA_MAX ? 4 * llc : GA_MAX;
+	if (max < MEGABYTES(64))
+		max = MEGABYTES(64);
+	table = mmap(NULL, max, prot, flags, -1, 0);
+	idx = mmap(NULL, GA_ELEMENTS * sizeof(*idx), prot, flags, -1, 0);
+	if (table == MAP_FAILED || idx == MAP_FAILED)
+		die("mmap()");
+	for (i = 0; i < max / sizeof(*table); i++)
+		table[i] = i;
+
+	fprintf(stdout, "\nHardware gathers vs scalar loads, up to %s\n",
+		isa_names[isa_level()]);
+	sweep(4, (uint8_t *)table, max, idx);
+	sweep(8, (uint8_t *)table, max, idx);
+	munmap(idx, GA_ELEMENTS * sizeof(*idx));
+	munmap(table, max);
+}
@@ -0,0 +1,214 @@
+/*
+ * inclusion.c	- measure whether each cache level is inclusive, exclusive
+ * 		  or neither (NINE) of the levels above it, next to what
+ * 		  CPUID leaf 04H EDX[1] claims.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Hot line test: a line is loaded into L1 and kept there by reloading it
+ * between the loads of a stream twice the size of the level under test.
+ * L1 hits never reach the lower levels, so the line ages out of them; when
+ * the level is inclusive its eviction back-invalidates the L1 copy and the
+ * final load of the line misses L1. A control run streams half the level
+ * size: if the line is lost then too, something else (e.g. a sibling
+ * hyperthread) evicts it and the test is inconclusive.
+ *
+ * Same-set test: lines congruent in the level (and hence in the one above)
+ * are walked cyclically. If the level is exclusive the two sets together
+ * hold ways + ways of the level above distinct lines, so a walk of
+ * ways + ways_above / 2 lines keeps hitting, while a NINE or inclusive level
+ * misses on it like on the control walk of ways + ways_above + 4 lines.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "evset.h"
+#include "sim.h"
+
+#define INCL_TRIES	5	/* hot line runs, median taken */
+#define INCL_HOT_EVERY	4	/* stream lines between hot line reloads */
+#define INCL_ROUNDS	8	/* rounds of the same-set walks */
+#define INCL_CAL	31
+#define MAX_CONG	(3 * SIM_MAX_WAYS)
+
+static unsigned seed = 0x1c1;
+
+/* Median latency of @x after streaming @size bytes of @buf with @x hot. */
+static unsigned hot_line(const uint8_t *x, const uint8_t *buf, size_t size,
+			 unsigned line)
+{
+	unsigned lat[INCL_TRIES];
+	size_t off;
+	int t, k = 0;
+
+	for (t = 0; t < INCL_TRIES; t++) {
+		maccess(x);
+		for (off = 0; off < size; off += line) {
+			maccess(buf + off);
+			if (++k == INCL_HOT_EVERY) {
+				maccess(x);
+				k = 0;
+			}
+		}
+		lat[t] = access_latency(x);
+	}
+	return median(lat, INCL_TRIES);
+}
+
+/* Hit rate, after the first round, of a cyclic walk over @n lines. */
+static double walk(uint8_t **lines, int n, unsigned threshold)
+{
+	int r, i, hits = 0;
+
+	for (i = 0; i < n; i++)
+		clflush(lines[i]);
+	asm volatile ("mfence" ::: "memory");
+	for (r = 0; r < INCL_ROUNDS; r++)
+		for (i = 0; i < n; i++)
+			if (access_latency(lines[i]) < threshold && r)
+				hits++;
+	return (double)hits / ((INCL_ROUNDS - 1) * n);
+}
+
+/*
+ * Same-set walks for @c, returns 0 and the hit rates, or -1 if no eviction
+ * set could be built.
+ */
+static int same_set(const struct evpool *pool, const struct cache_info *c,
+		    const struct cache_info *above, double *rate,
+		    double *control)
+{
+	uint8_t *cong[MAX_CONG], *upper[2 * SIM_MAX_WAYS];
+	unsigned hit[INCL_CAL], miss[INCL_CAL], threshold;
+	int n, nupper, i, need = c->ways + above->ways + 4;
+	uint8_t *x;
+
+	n = evset_build(pool, c, above, cong, MAX_CONG, upper, &nupper,
+			2 * above->ways, &seed);
+	if (n < need + 1)
+		return -1;
+	/* A line held by the level only, and one missing from both. */
+	x = cong[need];
+	for (i = 0; i < INCL_CAL; i++) {
+		maccess(x);
+		evset_traverse(upper, nupper, 2);
+		tlb_warm(x);
+		hit[i] = access_latency(x);
+		evset_traverse(cong, need, 2);
+		tlb_warm(x);
+		miss[i] = access_latency(x);
+	}
+	threshold = (median(hit, INCL_CAL) + median(miss, INCL_CAL)) / 2;
+	*rate = walk(cong, c->ways + above->ways / 2, threshold);
+	*control = walk(cong, need, threshold);
+	return 0;
+}
+
+void inclusion_benchmark(void)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c, *l1, *above;
+	unsigned lat[INCL_CAL], h1, h2, thr1, level, inclusive_above = 0;
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	struct evpool pool;
+	size_t pool_size = 0, l2_stream;
+	uint8_t *x;
+	int n, i;
+
+	fprintf(stdout, "\nInclusion of the levels above, measured vs CPUID\n");
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	if (!(l1 = cache_data_level(ci, n, 1)) || !cache_data_level(ci, n, 2)) {
+		fprintf(stdout, "Needs at least two data cache levels\n");
+		return;
+	}
+	for (level = 2; (c = cache_data_level(ci, n, level)); level++)
+		pool_size = 2 * c->size;
+	if (pool_size > GIGABYTES(1))
+		pool_size = GIGABYTES(1);
+	if (evpool_init(&pool, pool_size))
+		die("evpool_init()");
+	x = mmap(NULL, getpagesize(), prot, flags, -1, 0);
+	if (x == MAP_FAILED)
+		die("mmap()");
+	x[0] = 1;
+
+	/* L1 hit against L2 hit latency. */
+	for (i = 0; i < INCL_CAL; i++) {
+		maccess(x);
+		lat[i] = access_latency(x);
+	}
+	h1 = median(lat, INCL_CAL);
+	l2_stream = 4 * l1->size < pool.size ? 4 * l1->size : pool.size;
+	for (i = 0; i < INCL_CAL; i++) {
+		size_t off;
+
+		maccess(x);
+		for (off = 0; off < l2_stream; off += l1->line_size)
+			maccess(pool.base + off);
+		lat[i] = access_latency(x);
+	}
+	h2 = median(lat, INCL_CAL);
+	thr1 = (h1 + h2) / 2;
+	fprintf(stdout, " L1 hit %u cycles, L2 hit %u cycles\n", h1, h2);
+	fprintf(stdout, " L   CPUID      Hot line after stream   "
+		"Same-set hits (walk/control)   Measured\n");
+
+	for (level = 2; (c = cache_data_level(ci, n, level)); level++) {
+		size_t stream = 2 * c->size < pool.size ? 2 * c->size : pool.size;
+		double rate, control;
+		bool survived, set_ok, noisy;
+		unsigned after, ctl;
+		const char *verdict;
+
+		above = cache_data_level(ci, n, level - 1);
+		ctl = hot_line(x, pool.base, stream / 4, l1->line_size);
+		after = hot_line(x, pool.base, stream, l1->line_size);
+		survived = after < thr1;
+		noisy = ctl >= thr1;
+		set_ok = c->ways <= SIM_MAX_WAYS && above->ways <= SIM_MAX_WAYS &&
+			!same_set(&pool, c, above, &rate, &control);
+
+		fprintf(stdout, " L%u  %-9s  %4u cyc, %-12s", level,
+			c->inclusive ? "inclusive" : "non-incl.", after,
+			survived ? "in L1" : "evicted");
+		if (set_ok)
+			fprintf(stdout, "  %9.1f%% / %5.1f%%          ",
+				100.0 * rate, 100.0 * control);
+		else
+			fprintf(stdout, "  %-29s", "no eviction set");
+
+		if (noisy)
+			verdict = "inconclusive, L1 copy lost without pressure";
+		else if (!survived && inclusive_above)
+			verdict = "masked by inclusive upper level";
+		else if (!survived)
+			verdict = "inclusive";
+		else if (!set_ok)
+			verdict = "not inclusive (NINE or exclusive)";
+		else if (rate >= 0.5 && rate - control >= 0.25)
+			verdict = "exclusive";
+		else
+			verdict = "NINE";
+		fprintf(stdout, " %s", verdict);
+		/* Only a verdict the test reached can contradict CPUID. */
+		if (!noisy && !(!survived && inclusive_above) &&
+		    survived == c->inclusive)
+			fprintf(stdout, "  (differs from CPUID)");
+		fprintf(stdout, "\n");
+		if (!noisy && !survived && !inclusive_above)
+			inclusive_above = level;
+		if (stream < 2 * c->size)
+			fprintf(stdout, "    stream capped at %zu MB, result for "
+				"L%u may be pessimistic\n", stream >> 20, level);
+	}
+	munmap(x, getpagesize());
+	evpool_destroy(&pool);
+}
@@ -0,0 +1,345 @@
+/*
+ * interfere.c	- controlled cache, memory bandwidth or TLB interference
+ * 		  from pinned threads while a command runs.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Each thread walks its own buffer in one of three ways:
+ *
+ *	llc	one load per line over the LLC size, sequentially, which keeps
+ *		that much of the LLC filled with our lines
+ *	bw	one load and one store per line over four times the LLC, all
+ *		misses, which takes memory read and write back bandwidth
+ *	tlb	one load per page over 64K pages (256 MB) in random order,
+ *		which misses the second level TLB on every access
+ *
+ * The llc and bw sizes are for all threads together, each walks its share;
+ * the tlb size is per thread. -s sets the footprint of each thread. With
+ * -r the walk is paced to a target rate per thread, in MB/s for llc and bw
+ * and in thousands of pages per second for tlb: after every chunk the
+ * thread sleeps until it is back on schedule. The threads run on the cpus
+ * of -c, one each, by default every online cpu sharing the LLC with cpu 0
+ * except cpu 0. The command is pinned to the cpus left over, cpu 0 by
+ * default, so that it never shares a cpu with a thread; -C pins it
+ * elsewhere. With a single cpu they share it.
+ *
+ * The command runs while the threads do, or they run for -d seconds. At the
+ * end the rate each thread achieved and its average ns per access are
+ * printed on stderr, with the command's wall time; the exit status is the
+ * command's. The rate is of accesses only: how much of the LLC the lines
+ * really occupy is not measured (see occupancy in benchmark for that).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cacheinfo.h"
+#include "topology.h"
+#include "util.h"
+
+#define IF_CHUNK	256		/* accesses between pacing checks */
+#define IF_TLB_PAGES	(1 << 16)
+#define IF_PAGE		4096
+
+enum if_mode { IF_LLC, IF_BW, IF_TLB };
+
+static const char *const if_modes[] = { "llc", "bw", "tlb" };
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	uint8_t *buf;
+	size_t size;
+	uint32_t *order;		/* page order for IF_TLB */
+	double rate;			/* target accesses per ns, 0 unpaced */
+	unsigned long long accesses;
+	double ns;			/* wall time */
+	double busy_ns;			/* per access, pacing sleeps left out */
+};
+
+static enum if_mode mode = IF_LLC;
+static volatile int stop;
+
+static void die(const char *str) __attribute__((__noreturn__));
+
+/* Exit program */
+static void die(const char *str)
+{
+	perror(str);
+	exit(1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-m llc|bw|tlb] [-s SIZE] [-r RATE] [-c CPUS] "
+		"[-C CPUS] [-d SECS] [-- COMMAND [ARGS]...]\n"
+		"  -m  interference: LLC occupancy, memory bandwidth or TLB "
+		"misses\n"
+		"  -s  footprint per thread (default LLC size or 4x LLC split "
+		"between the\n      threads, 256M each for tlb)\n"
+		"  -r  target rate per thread: MB/s (llc, bw), "
+		"K pages/s (tlb)\n"
+		"  -c  cpus of the threads, e.g. 1-3,8 (default LLC siblings "
+		"of cpu 0)\n"
+		"  -C  cpus of the command (default the cpus the threads "
+		"leave)\n"
+		"  -d  seconds to run without a command (default 10)\n", prog);
+	exit(2);
+}
+
+/* Parse "32k", "2M", "1G" or plain bytes. */
+static size_t parse_size(const char *str)
+{
+	char *end;
+	size_t v = strtoull(str, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G':
+		v <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		v <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		v <<= 10;
+	}
+	return v;
+}
+
+/* Sleep until @done accesses are due at @w's rate, counted from @start. */
+static void pace(const struct worker *w, unsigned long long done,
+		 double start)
+{
+	double ahead = start + done / w->rate - now_ns();
+	struct timespec ts;
+
+	if (ahead <= 0)
+		return;
+	ts.tv_sec = ahead / 1e9;
+	ts.tv_nsec = ahead - ts.tv_sec * 1e9;
+	nanosleep(&ts, NULL);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	size_t lines = w->size / 64, pages = w->size / IF_PAGE, i = 0;
+	double start = now_ns(), busy = 0;
+	unsigned long long n = 0;
+	uint64_t sum = 0;
+
+	while (!stop) {
+		double t0 = now_ns();
+		int k;
+
+		for (k = 0; k < IF_CHUNK; k++) {
+			switch (mode) {
+			case IF_LLC:
+				sum += *(volatile uint64_t *)(w->buf + i * 64);
+				i = i + 1 < lines ? i + 1 : 0;
+				break;
+			case IF_BW:
+				(*(volatile uint64_t *)(w->buf + i * 64))++;
+				i = i + 1 < lines ? i + 1 : 0;
+				break;
+			case IF_TLB:
+				/* Another line of each page, to spread sets. */
+				sum += *(volatile uint64_t *)(w->buf +
+					(size_t)w->order[i] * IF_PAGE +
+					(i % (IF_PAGE / 64)) * 64);
+				i = i + 1 < pages ? i + 1 : 0;
+				break;
+			}
+		}
+		busy += now_ns() - t0;
+		n += IF_CHUNK;
+		if (w->rate)
+			pace(w, n, start);
+	}
+	asm volatile ("" :: "r"(sum));
+	w->accesses = n;
+	w->ns = now_ns() - start;
+	w->busy_ns = n ? busy / n : 0;
+	return NULL;
+}
+
+static void worker_init(struct worker *w, size_t size, double rate,
+			unsigned *seed)
+{
+	size_t i;
+
+	w->size = size;
+	w->buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (w->buf == MAP_FAILED)
+		die("mmap()");
+	memset(w->buf, 1, size);
+	if (mode == IF_TLB) {
+		size_t pages = size / IF_PAGE;
+
+		if (!(w->order = malloc(pages * sizeof(*w->order))))
+			die("malloc()");
+		for (i = 0; i < pages; i++)
+			w->order[i] = i;
+		for (i = pages - 1; i > 0; i--) {
+			size_t j = rand_r(seed) % (i + 1);
+			uint32_t t = w->order[i];
+
+			w->order[i] = w->order[j];
+			w->order[j] = t;
+		}
+	}
+	/* MB/s and K pages/s, to accesses per ns. */
+	w->rate = mode == IF_TLB ? rate * 1e3 / 1e9 : rate * 1e6 / 64 / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	cpu_set_t cpus, cmd_cpus;
+	bool cmd_pinned = false, have_cpus = false;
+	double rate = 0, secs = 10, t0, wall;
+	size_t size = 0, llc;
+	struct worker *w;
+	unsigned seed = 0x1f, i;
+	int opt, nw = 0, cpu, status = 0;
+	pid_t pid = 0;
+
+	while ((opt = getopt(argc, argv, "+m:s:r:c:C:d:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (i = 0; i < 3 && strcmp(optarg, if_modes[i]); i++)
+				;
+			if (i == 3)
+				usage(argv[0]);
+			mode = i;
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'c':
+			if (parse_cpus(optarg, &cpus))
+				usage(argv[0]);
+			have_cpus = true;
+			break;
+		case 'C':
+			if (parse_cpus(optarg, &cmd_cpus))
+				usage(argv[0]);
+			cmd_pinned = true;
+			break;
+		case 'd':
+			secs = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!(llc = cache_level_size(3)) && !(llc = cache_level_size(2)))
+		llc = 8 << 20;
+	if (!have_cpus) {
+		if (cache_domain(0, 0, &cpus))
+			CPU_ZERO(&cpus);
+		CPU_CLR(0, &cpus);
+		/* One cpu: share it with the command rather than do nothing. */
+		if (!CPU_COUNT(&cpus))
+			CPU_SET(0, &cpus);
+	}
+	if (!cmd_pinned) {
+		if (sched_getaffinity(0, sizeof(cmd_cpus), &cmd_cpus))
+			die("sched_getaffinity()");
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &cpus))
+				CPU_CLR(cpu, &cmd_cpus);
+		/* Nothing left: the command shares the threads' cpus. */
+		if (!CPU_COUNT(&cmd_cpus) &&
+		    sched_getaffinity(0, sizeof(cmd_cpus), &cmd_cpus))
+			die("sched_getaffinity()");
+	}
+	/*
+	 * The LLC and the memory bus are shared, so their default footprint
+	 * is split between the threads; every core has its own TLB.
+	 */
+	if (!size && mode == IF_TLB)
+		size = (size_t)IF_TLB_PAGES * IF_PAGE;
+	else if (!size)
+		size = (mode == IF_LLC ? llc : 4 * llc) / CPU_COUNT(&cpus) /
+		       IF_PAGE * IF_PAGE;
+	if (size < IF_PAGE)
+		usage(argv[0]);
+
+	if (!(w = calloc(CPU_COUNT(&cpus), sizeof(*w))))
+		die("calloc()");
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		cpu_set_t one;
+		pthread_attr_t attr;
+
+		if (!CPU_ISSET(cpu, &cpus))
+			continue;
+		w[nw].cpu = cpu;
+		worker_init(&w[nw], size, rate, &seed);
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+		errno = pthread_create(&w[nw].thread, &attr, worker_run,
+				       &w[nw]);
+		pthread_attr_destroy(&attr);
+		if (errno)
+			die("pthread_create()");
+		nw++;
+	}
+
+	t0 = now_ns();
+	if (optind < argc) {
+		if ((pid = fork()) < 0)
+			die("fork()");
+		if (!pid) {
+			if (sched_setaffinity(0, sizeof(cmd_cpus), &cmd_cpus))
+				die("sched_setaffinity()");
+			execvp(argv[optind], argv + optind);
+			die(argv[optind]);
+		}
+		/* Let ^C reach the command, the threads stop when it exits. */
+		signal(SIGINT, SIG_IGN);
+		if (waitpid(pid, &status, 0) < 0)
+			die("waitpid()");
+	} else {
+		struct timespec ts = { secs, (secs - (time_t)secs) * 1e9 };
+
+		nanosleep(&ts, NULL);
+	}
+	wall = now_ns() - t0;
+	stop = 1;
+	for (i = 0; i < (unsigned)nw; i++)
+		pthread_join(w[i].thread, NULL);
+
+	fprintf(stderr, "\ninterfere: %s, %zuK per thread, %d thread%s, "
+		"%.3f s\n", if_modes[mode], size >> 10, nw, nw > 1 ? "s" : "",
+		wall / 1e9);
+	fprintf(stderr, "  cpu %12s  ns/access\n",
+		mode == IF_TLB ? "K pages/s" : "MB/s");
+	for (i = 0; i < (unsigned)nw; i++) {
+		double per_s = w[i].accesses / (w[i].ns / 1e9);
+
+		fprintf(stderr, " %4d %12.1f %10.2f\n", w[i].cpu,
+			mode == IF_TLB ? per_s / 1e3 : per_s * 64 / 1e6,
+			w[i].busy_ns);
+	}
+	if (pid)
+		return WIFEXITED(status) ? WEXITSTATUS(status) :
+			128 + WTERMSIG(status);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * kbench.c	- compare the Example 3 kernel run from user space with the
+ * 		  same kernel run by the read-cr0 module with interrupts and
+ * 		  preemption off, the noise floor of the measurement.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The module runs its samples from /sys/kernel/debug/cache_bench (cbench.c)
+ * and reports their min, median and max in TSC cycles. The user space loop
+ * here is the same C, also built at -O2, timed with the TSC too, on the
+ * same cpu. A max/min ratio well above the kernel's is what interrupts and
+ * preemption add.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cbench.h"
+
+#define KB_SAMPLES	11
+#define KB_COUNT	(1 << 20)
+
+static void kb_user(uint32_t *buf, size_t size, struct cbench_spread *s)
+{
+	volatile uint32_t *vbuf = buf;
+	unsigned cycles[KB_SAMPLES + 1];
+	size_t len = size / sizeof(uint32_t), i;
+	int k;
+
+	/* Sample 0 warms the caches up, like the module's untimed run. */
+	for (k = 0; k <= KB_SAMPLES; k++) {
+		uint64_t t0 = tsc_start();
+
+		for (i = 0; i < KB_COUNT; i++)
+			vbuf[(i * 16) & (len - 1)]++;
+		cycles[k] = tsc_stop() - t0;
+	}
+	s->median = median(cycles + 1, KB_SAMPLES);
+	s->min = s->max = cycles[1];
+	for (k = 1; k <= KB_SAMPLES; k++) {
+		if (cycles[k] < s->min)
+			s->min = cycles[k];
+		if (cycles[k] > s->max)
+			s->max = cycles[k];
+	}
+}
+
+void kbench_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	struct cbench_spread u, k;
+	uint32_t *buf;
+	size_t size;
+
+	fprintf(stdout, "\nExample 3 kernel, user space vs in-kernel with "
+		"interrupts off, TSC cycles per %d iterations\n", KB_COUNT);
+	if (!cbench_available()) {
+		fprintf(stdout, " %s not found, load read-cr0/rcr0.ko and mount "
+			"debugfs\n", CBENCH_DIR);
+		return;
+	}
+	buf = mmap(NULL, CBENCH_MAX, prot, flags, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap()");
+	fprintf(stdout, "    Size     user median  max/min    kernel median  "
+		"max/min\n");
+	for (size = KILOBYTES(1); size <= CBENCH_MAX; size <<= 1) {
+		kb_user(buf, size, &u);
+		if (cbench_run(CB_SIZES, size, KB_COUNT, KB_SAMPLES, &k))
+			die(CBENCH_DIR);
+		fprintf(stdout, " %7zuK %15llu %8.3f %16llu %8.3f\n",
+			size >> 10, u.median, (double)u.max / u.min,
+			k.median, (double)k.max / k.min);
+	}
+	munmap(buf, CBENCH_MAX);
+}
@@ -0,0 +1,275 @@
+/*
+ * linesize.c	- measure the coherency line size, the granularity lines are
+ * 		  brought in with on reads (adjacent line prefetch) and the one
+ * 		  writers on different cores interfere at, and derive the
+ * 		  destructive interference size to pad shared data to.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Coherency line: a cached line @x stays cached when another address is
+ * clflush'ed unless both fall in the same line, so the smallest offset @d
+ * for which flushing @x + @d leaves @x fast is the line size.
+ *
+ * Read granularity: the eight lines of a 512 byte block of a random page are
+ * flushed and one of them is loaded. After the miss has been served, the
+ * line sharing its 128 byte aligned pair (the buddy) and the neighbour on
+ * the other side (in the next pair) are timed. The spatial prefetcher of
+ * Intel cores fetches the buddy along, making the pair the transfer unit;
+ * a plain next line prefetcher would fetch both neighbours alike.
+ *
+ * Contended writes: two threads on different physical cores store to their
+ * own counter, @d bytes apart. The stores slow each other down for as long
+ * as the counters share a transfer unit, so the smallest @d running as fast
+ * as counters a page apart is the write granularity. It needs two cores.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "topology.h"
+#include "util.h"
+
+#define LS_POOL		MEGABYTES(64)
+#define LS_TRIALS	201	/* per offset, odd for the medians */
+#define LS_WAIT		20000	/* TSC cycles for a miss to be served */
+#define LS_MAX_OFF	512
+#define LS_STORES	(20 * 1000 * 1000)
+#define LS_SLACK	1.15	/* contended/uncontended time still "apart" */
+
+static unsigned seed = 0x11e5;
+
+static void tsc_wait(uint64_t cycles)
+{
+	uint64_t t0 = tsc_start();
+
+	while (tsc_start() - t0 < cycles)
+		;
+}
+
+/* A 512 byte aligned block of a random page of @pool. */
+static uint8_t *random_block(uint8_t *pool)
+{
+	size_t page = rand_r(&seed) % (LS_POOL / 4096);
+
+	return pool + page * 4096 + (rand_r(&seed) % 8) * 512;
+}
+
+/* Smallest offset whose clflush leaves a cached line alone. */
+static unsigned coherency_line(uint8_t *pool)
+{
+	unsigned lat[LS_TRIALS], hit, d;
+	int i;
+
+	for (i = 0; i < LS_TRIALS; i++) {
+		uint8_t *x = random_block(pool);
+
+		maccess(x);
+		lat[i] = access_latency(x);
+	}
+	hit = median(lat, LS_TRIALS);
+
+	for (d = 8; d < LS_MAX_OFF; d <<= 1) {
+		for (i = 0; i < LS_TRIALS; i++) {
+			uint8_t *x = random_block(pool);
+
+			maccess(x);
+			clflush(x + d);
+			asm volatile ("mfence" ::: "memory");
+			lat[i] = access_latency(x);
+		}
+		if (median(lat, LS_TRIALS) < 2 * hit)
+			return d;
+	}
+	return 0;
+}
+
+/*
+ * Fraction of the trials in which the buddy of a missed line, and its
+ * neighbour in the next pair, were fetched along with it.
+ */
+static void read_granularity(uint8_t *pool, unsigned line, double *buddy,
+			     double *cross)
+{
+	unsigned lat[LS_TRIALS], miss, threshold;
+	int i, nb = 0, nc = 0;
+
+	for (i = 0; i < LS_TRIALS; i++) {
+		uint8_t *x = random_block(pool);
+
+		clflush(x);
+		asm volatile ("mfence" ::: "memory");
+		maccess(x + 2048);
+		lat[i] = access_latency(x);
+	}
+	miss = median(lat, LS_TRIALS);
+	for (i = 0; i < LS_TRIALS; i++) {
+		uint8_t *x = random_block(pool);
+
+		maccess(x);
+		lat[i] = access_latency(x);
+	}
+	threshold = (median(lat, LS_TRIALS) + miss) / 2;
+
+	/*
+	 * Half of the trials load the first line of a pair, half the second.
+	 * Either way the buddy or the line on the other side is timed.
+	 */
+	for (i = 0; i < 4 * LS_TRIALS; i++) {
+		uint8_t *b = random_block(pool), *pair = b + 4 * line;
+		uint8_t *x = i & 1 ? pair + line : pair;
+		uint8_t *buddy_line = i & 1 ? pair : pair + line;
+		uint8_t *cross_line = i & 1 ? pair + 2 * line : pair - line;
+		bool is_buddy = i & 2;
+		int k;
+
+		for (k = 0; k < 8; k++)
+			clflush(b + k * line);
+		asm volatile ("mfence" ::: "memory");
+		/* Sets up the TLB entry, not in the flushed block. */
+		tlb_warm(x);
+		maccess(x);
+		tsc_wait(LS_WAIT);
+		if (access_latency(is_buddy ? buddy_line : cross_line) >=
+		    threshold)
+			continue;
+		if (is_buddy)
+			nb++;
+		else
+			nc++;
+	}
+	*buddy = (double)nb / (2 * LS_TRIALS);
+	*cross = (double)nc / (2 * LS_TRIALS);
+}
+
+struct writer {
+	int cpu;
+	volatile uint64_t *counter;
+	volatile int *go;
+	double ns;
+};
+
+static void *writer_run(void *arg)
+{
+	struct writer *w = arg;
+	double start;
+	long i;
+
+	__sync_fetch_and_add(w->go, 1);
+	while (*w->go < 2)
+		;
+	start = now_ns();
+	for (i = 0; i < LS_STORES; i++)
+		(*w->counter)++;
+	w->ns = (now_ns() - start) / LS_STORES;
+	return NULL;
+}
+
+/*
+ * Mean ns per store of two writers @d bytes apart on @cpu0 and @cpu1. The
+ * writers are SCHED_OTHER and start on their CPU: main is SCHED_FIFO on
+ * CPU0, and a writer inheriting that would spin there on @go while the
+ * other one never gets to run.
+ */
+static double contended(uint8_t *page, unsigned d, int cpu0, int cpu1)
+{
+	struct writer w[2] = {
+		{ cpu0, (volatile uint64_t *)page },
+		{ cpu1, (volatile uint64_t *)(page + d) },
+	};
+	volatile int go = 0;
+	pthread_t t[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		struct sched_param param = { 0 };
+		pthread_attr_t attr;
+		cpu_set_t set;
+
+		w[i].go = &go;
+		CPU_ZERO(&set);
+		CPU_SET(w[i].cpu, &set);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+		errno = pthread_create(&t[i], &attr, writer_run, &w[i]);
+		pthread_attr_destroy(&attr);
+		if (errno)
+			die("pthread_create()");
+	}
+	for (i = 0; i < 2; i++)
+		pthread_join(t[i], NULL);
+	return (w[0].ns + w[1].ns) / 2;
+}
+
+void linesize_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	unsigned line, read_unit, write_unit = 0, d, dis;
+	double buddy, cross, base;
+	uint8_t *pool;
+	int cpu;
+
+	fprintf(stdout, "\nCoherency line, transfer granularity and destructive "
+		"interference size\n");
+	pool = mmap(NULL, LS_POOL, prot, flags, -1, 0);
+	if (pool == MAP_FAILED)
+		die("mmap()");
+	/* Private pages, not the shared zero page. */
+	for (d = 0; d < LS_POOL; d += 4096)
+		pool[d] = 1;
+
+	line = coherency_line(pool);
+	fprintf(stdout, " Coherency line (clflush)    %u bytes, CPUID says %u\n",
+		line, cache_line_size());
+	if (!line)
+		line = cache_line_size();
+
+	read_granularity(pool, line, &buddy, &cross);
+	read_unit = buddy >= 0.5 && buddy - cross >= 0.25 ? 2 * line : line;
+	fprintf(stdout, " Read granularity            %u bytes (buddy line "
+		"fetched %.0f%%, next pair %.0f%%)\n", read_unit,
+		100.0 * buddy, 100.0 * cross);
+
+	/* Another core: SMT siblings share L1 and never contend for lines. */
+	if ((cpu = core_peer(0, false)) < 0) {
+		fprintf(stdout, " Contended writes            not measured, "
+			"needs two cores\n");
+	} else {
+		base = contended(pool, 4096, 0, cpu);
+		fprintf(stdout, " Contended writes, CPU0 and CPU%d, %.2f ns/store "
+			"a page apart\n", cpu, base);
+		for (d = 8; d <= LS_MAX_OFF; d <<= 1) {
+			double ns = contended(pool, d, 0, cpu);
+
+			fprintf(stdout, "   %4u bytes apart  %6.2f ns/store\n",
+				d, ns);
+			if (!write_unit && ns <= LS_SLACK * base)
+				write_unit = d;
+		}
+		if (write_unit)
+			fprintf(stdout, " Write granularity           %u "
+				"bytes\n", write_unit);
+		else
+			fprintf(stdout, " Write granularity           > %u "
+				"bytes (not found)\n", LS_MAX_OFF);
+	}
+
+	/* Writers that contend up to LS_MAX_OFF apart were apart a page off. */
+	if (cpu >= 0 && !write_unit)
+		dis = 4096;
+	else
+		dis = read_unit > write_unit ? read_unit : write_unit;
+	fprintf(stdout, " Destructive interference    %u bytes%s\n", dis,
+		cpu < 0 ? " (from reads only)" :
+		!write_unit ? " (the page-apart distance)" : "");
+	munmap(pool, LS_POOL);
+}
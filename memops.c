@@ -0,0 +1,536 @@
+/*
+ * memops.c	- time copy and set strategies across sizes, alignments and
+ * 		  overlap, and find where each one starts to win.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Strategies: the libc routine, rep movsb/stosb (fast with ERMSB/FSRM),
+ * loops of unaligned 32 byte (AVX2) and 64 byte (AVX-512) vectors, and
+ * 32 byte streaming stores that bypass the caches. Each size is copied over
+ * and over until 64 MB have moved, so sizes that fit a cache level are
+ * timed hot in it, and the best of three runs is kept.
+ *
+ * The thresholds are where switching from the vector loops to rep
+ * movsb/stosb, and from every cached strategy to streaming stores, pays off
+ * most over the whole size range. They are
+ * meant to be compared with the enumerated L2 and L3 sizes: glibc puts its
+ * non-temporal threshold at a fraction of the L3 size by default.
+ */
+#define _GNU_SOURCE
+#include <immintrin.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "cpufeature.h"
+#include "memops.h"
+#include "trace.h"
+#include "util.h"
+
+#define MEMOPS_BYTES	MEGABYTES(64)	/* moved per timing run */
+#define MEMOPS_MAX_REPS	(1 << 20)
+#define MEMOPS_TRIES	3
+#define MEMOPS_SIZES	40
+
+/*
+ * gcc turns the byte loops below into calls to memset()/memcpy(), which
+ * would time libc in the columns of the vector loops.
+ */
+#define NO_LIBC_CALLS	optimize("no-tree-loop-distribute-patterns")
+
+/*
+ * rep movsb/stosb and libc move data in chunks the trace cannot see, so
+ * they are recorded as a load from @s (unless NULL) and a store to @d per
+ * line.
+ */
+static inline void trace_lines(void *d, const void *s, size_t n)
+{
+#ifdef CONFIG_TRACE
+	size_t i;
+
+	for (i = 0; i < n; i += 64) {
+		if (s)
+			TRACE_LOAD((const uint8_t *)s + i);
+		TRACE_STORE((uint8_t *)d + i);
+	}
+#endif
+}
+
+static void copy_movsb(void *d, const void *s, size_t n)
+{
+	trace_lines(d, s, n);
+	asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(n) :: "memory");
+}
+
+static void set_stosb(void *d, int c, size_t n)
+{
+	trace_lines(d, NULL, n);
+	asm volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+}
+
+/*
+ * Vector loops: whole vectors, then one last vector ending at @n which may
+ * overlap the previous one. Shorter copies go byte by byte.
+ */
+__attribute__((target("avx2"), NO_LIBC_CALLS))
+static void copy_avx2(void *d, const void *s, size_t n)
+{
+	uint8_t *dp = d;
+	const uint8_t *sp = s;
+	size_t i;
+
+	if (n < 32) {
+		for (i = 0; i < n; i++) {
+			TRACE_LOAD(sp + i);
+			TRACE_STORE(dp + i);
+			dp[i] = sp[i];
+		}
+		return;
+	}
+	for (i = 0; i + 32 <= n; i += 32) {
+		TRACE_LOAD(sp + i);
+		TRACE_STORE(dp + i);
+		_mm256_storeu_si256((__m256i *)(dp + i),
+				    _mm256_loadu_si256((const __m256i *)(sp + i)));
+	}
+	if (i < n) {
+		TRACE_LOAD(sp + n - 32);
+		TRACE_STORE(dp + n - 32);
+		_mm256_storeu_si256((__m256i *)(dp + n - 32),
+				    _mm256_loadu_si256((const __m256i *)
+						       (sp + n - 32)));
+	}
+}
+
+__attribute__((target("avx2"), NO_LIBC_CALLS))
+static void set_avx2(void *d, int c, size_t n)
+{
+	__m256i v = _mm256_set1_epi8(c);
+	uint8_t *dp = d;
+	size_t i;
+
+	if (n < 32) {
+		for (i = 0; i < n; i++) {
+			TRACE_STORE(dp + i);
+			dp[i] = c;
+		}
+		return;
+	}
+	for (i = 0; i + 32 <= n; i += 32) {
+		TRACE_STORE(dp + i);
+		_mm256_storeu_si256((__m256i *)(dp + i), v);
+	}
+	if (i < n) {
+		TRACE_STORE(dp + n - 32);
+		_mm256_storeu_si256((__m256i *)(dp + n - 32), v);
+	}
+}
+
+__attribute__((target("avx512f"), NO_LIBC_CALLS))
+static void copy_avx512(void *d, const void *s, size_t n)
+{
+	uint8_t *dp = d;
+	const uint8_t *sp = s;
+	size_t i;
+
+	if (n < 64) {
+		for (i = 0; i < n; i++) {
+			TRACE_LOAD(sp + i);
+			TRACE_STORE(dp + i);
+			dp[i] = sp[i];
+		}
+		return;
+	}
+	for (i = 0; i + 64 <= n; i += 64) {
+		TRACE_LOAD(sp + i);
+		TRACE_STORE(dp + i);
+		_mm512_storeu_si512(dp + i, _mm512_loadu_si512(sp + i));
+	}
+	if (i < n) {
+		TRACE_LOAD(sp + n - 64);
+		TRACE_STORE(dp + n - 64);
+		_mm512_storeu_si512(dp + n - 64, _mm512_loadu_si512(sp + n - 64));
+	}
+}
+
+__attribute__((target("avx512f"), NO_LIBC_CALLS))
+static void set_avx512(void *d, int c, size_t n)
+{
+	__m512i v = _mm512_set1_epi8(c);
+	uint8_t *dp = d;
+	size_t i;
+
+	if (n < 64) {
+		for (i = 0; i < n; i++) {
+			TRACE_STORE(dp + i);
+			dp[i] = c;
+		}
+		return;
+	}
+	for (i = 0; i + 64 <= n; i += 64) {
+		TRACE_STORE(dp + i);
+		_mm512_storeu_si512(dp + i, v);
+	}
+	if (i < n) {
+		TRACE_STORE(dp + n - 64);
+		_mm512_storeu_si512(dp + n - 64, v);
+	}
+}
+
+/*
+ * Streaming stores need an aligned destination: the unaligned head and the
+ * tail are done with the AVX2 loop. The trace has no kind for them, they
+ * are recorded as plain stores.
+ */
+__attribute__((target("avx2"), NO_LIBC_CALLS))
+static void copy_nt(void *d, const void *s, size_t n)
+{
+	uint8_t *dp = d;
+	const uint8_t *sp = s;
+	size_t head = -(uintptr_t)dp & 31, i;
+
+	if (n < 64) {
+		copy_avx2(d, s, n);
+		return;
+	}
+	copy_avx2(dp, sp, head);
+	for (i = head; i + 32 <= n; i += 32) {
+		TRACE_LOAD(sp + i);
+		TRACE_STORE(dp + i);
+		_mm256_stream_si256((__m256i *)(dp + i),
+				    _mm256_loadu_si256((const __m256i *)(sp + i)));
+	}
+	_mm_sfence();
+	copy_avx2(dp + i, sp + i, n - i);
+}
+
+__attribute__((target("avx2"), NO_LIBC_CALLS))
+static void set_nt(void *d, int c, size_t n)
+{
+	__m256i v = _mm256_set1_epi8(c);
+	uint8_t *dp = d;
+	size_t head = -(uintptr_t)dp & 31, i;
+
+	if (n < 64) {
+		set_avx2(d, c, n);
+		return;
+	}
+	set_avx2(dp, c, head);
+	for (i = head; i + 32 <= n; i += 32) {
+		TRACE_STORE(dp + i);
+		_mm256_stream_si256((__m256i *)(dp + i), v);
+	}
+	_mm_sfence();
+	set_avx2(dp + i, c, n - i);
+}
+
+static void copy_libc(void *d, const void *s, size_t n)
+{
+	trace_lines(d, s, n);
+	memcpy(d, s, n);
+}
+
+static void set_libc(void *d, int c, size_t n)
+{
+	trace_lines(d, NULL, n);
+	memset(d, c, n);
+}
+
+/* Backwards rep movsb, what a naive memmove does for dst > src. */
+static void move_movsb(void *d, const void *s, size_t n)
+{
+	uint8_t *dp = (uint8_t *)d + n - 1;
+	const uint8_t *sp = (const uint8_t *)s + n - 1;
+
+	trace_lines(d, s, n);
+	asm volatile ("std\n\trep movsb\n\tcld"
+		      : "+D"(dp), "+S"(sp), "+c"(n) :: "memory");
+}
+
+static void move_libc(void *d, const void *s, size_t n)
+{
+	trace_lines(d, s, n);
+	memmove(d, s, n);
+}
+
+enum { ST_LIBC, ST_REP, ST_AVX2, ST_AVX512, ST_NT, NSTRATEGIES };
+
+struct strategy {
+	const char *name;
+	void (*copy)(void *d, const void *s, size_t n);
+	void (*set)(void *d, int c, size_t n);
+	enum isa needs;
+};
+
+static const struct strategy strategies[NSTRATEGIES] = {
+	[ST_LIBC] = { "libc", copy_libc, set_libc, ISA_SCALAR },
+	[ST_REP] = { "rep", copy_movsb, set_stosb, ISA_SCALAR },
+	[ST_AVX2] = { "avx2", copy_avx2, set_avx2, ISA_AVX2 },
+	[ST_AVX512] = { "avx512", copy_avx512, set_avx512, ISA_AVX512 },
+	[ST_NT] = { "nt", copy_nt, set_nt, ISA_AVX2 },
+};
+
+static bool usable(const struct strategy *st)
+{
+	return st->needs <= isa_level();
+}
+
+/*
+ * GB/s of @copy (or @set when @copy is NULL) of @n bytes from @s to @d,
+ * best of a few runs.
+ */
+static double rate(void (*copy)(void *, const void *, size_t),
+		   void (*set)(void *, int, size_t), uint8_t *d,
+		   const uint8_t *s, size_t n)
+{
+	size_t reps = MEMOPS_BYTES / n, r;
+	double best = 0;
+	int t;
+
+	if (!reps)
+		reps = 1;
+	if (reps > MEMOPS_MAX_REPS)
+		reps = MEMOPS_MAX_REPS;
+	for (t = 0; t < MEMOPS_TRIES; t++) {
+		double t0 = now_ns(), gbs;
+
+		for (r = 0; r < reps; r++) {
+			if (copy)
+				copy(d, s, n);
+			else
+				set(d, r, n);
+		}
+		gbs = n * reps / (now_ns() - t0);
+		if (gbs > best)
+			best = gbs;
+	}
+	return best;
+}
+
+void print_size(FILE *fp, size_t n)
+{
+	if (n >= GIGABYTES(1))
+		fprintf(fp, " %5zuG", n >> 30);
+	else if (n >= MEGABYTES(1))
+		fprintf(fp, " %5zuM", n >> 20);
+	else if (n >= KILOBYTES(1))
+		fprintf(fp, " %5zuK", n >> 10);
+	else
+		fprintf(fp, " %5zuB", n);
+}
+
+/*
+ * The single crossover size that serves best: below it the fastest of the
+ * strategies selected by @rival is used, from it on @who, and the geometric
+ * mean rate over all sizes is highest. MEMOPS_NEVER if @who is better left
+ * unused, 0 if no size had both @who and a rival timed. One
+ * noisy size cannot move the crossover far, which it would if @who had to
+ * win at every size above it.
+ */
+static size_t takes_over(double gbs[][NSTRATEGIES], const size_t *sizes,
+			 int nsizes, unsigned who, bool (*rival)(unsigned))
+{
+	double gain = 0, best_gain = 0;
+	size_t from = 0;
+	bool timed = false;
+	int i;
+	unsigned k;
+
+	/* Moving the crossover down one size adds that size's log ratio. */
+	for (i = nsizes - 1; i >= 0; i--) {
+		double best = 0;
+
+		for (k = 0; k < NSTRATEGIES; k++)
+			if (k != who && rival(k) && gbs[i][k] > best)
+				best = gbs[i][k];
+		if (!best || !gbs[i][who])
+			continue;
+		timed = true;
+		gain += log(gbs[i][who] / best);
+		if (gain > best_gain) {
+			best_gain = gain;
+			from = sizes[i];
+		}
+	}
+	return timed && !from ? MEMOPS_NEVER : from;
+}
+
+/* The vector loops, what rep movsb/stosb compete with. */
+static bool vector_rival(unsigned k)
+{
+	return (k == ST_AVX2 || k == ST_AVX512) && usable(&strategies[k]);
+}
+
+/*
+ * Every cached strategy, what streaming stores compete with. Not libc, which
+ * switches to streaming stores itself past its own threshold.
+ */
+static bool cached_rival(unsigned k)
+{
+	return k != ST_LIBC && k != ST_NT && usable(&strategies[k]);
+}
+
+/* Index of the fastest usable strategy in @gbs. */
+static unsigned winner(const double *gbs)
+{
+	unsigned k, w = 0;
+
+	for (k = 1; k < NSTRATEGIES; k++)
+		if (gbs[k] > gbs[w])
+			w = k;
+	return w;
+}
+
+static void sweep(const char *what, bool copy, uint8_t *d, const uint8_t *s,
+		  size_t max, double gbs[][NSTRATEGIES], size_t *sizes,
+		  int *nsizes, FILE *fp)
+{
+	size_t n;
+	unsigned k;
+	int i = 0;
+
+	if (fp) {
+		fprintf(fp, "\n %s, GB/s\n   Size", what);
+		for (k = 0; k < NSTRATEGIES; k++)
+			fprintf(fp, " %7s", strategies[k].name);
+		fprintf(fp, "  Best\n");
+	}
+	for (n = 1; n <= max && i < MEMOPS_SIZES; n <<= 1, i++) {
+		for (k = 0; k < NSTRATEGIES; k++) {
+			const struct strategy *st = &strategies[k];
+
+			gbs[i][k] = !usable(st) ? 0 : copy ?
+				rate(st->copy, NULL, d, s, n) :
+				rate(NULL, st->set, d, s, n);
+		}
+		sizes[i] = n;
+		if (!fp)
+			continue;
+		print_size(fp, n);
+		for (k = 0; k < NSTRATEGIES; k++)
+			fprintf(fp, " %7.2f", gbs[i][k]);
+		fprintf(fp, "  %s\n", strategies[winner(gbs[i])].name);
+	}
+	*nsizes = i;
+}
+
+/* Misaligned source/destination, and overlapping moves. */
+static void alignment(uint8_t *d, uint8_t *s, size_t max, FILE *fp)
+{
+	static const size_t sizes[] = {
+		256, KILOBYTES(4), KILOBYTES(64), MEGABYTES(1), MEGABYTES(16)
+	};
+	static const struct { unsigned s, d; } offs[] = {
+		{ 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 32 }
+	};
+	unsigned i, j, k;
+
+	fprintf(fp, "\n Copy by alignment (source+dest offset), GB/s\n"
+		"   Size  Offs");
+	for (k = 0; k < NSTRATEGIES; k++)
+		fprintf(fp, " %7s", strategies[k].name);
+	fprintf(fp, "\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (sizes[i] > max)
+			break;
+		for (j = 0; j < sizeof(offs) / sizeof(offs[0]); j++) {
+			print_size(fp, sizes[i]);
+			fprintf(fp, " %2u+%-2u", offs[j].s, offs[j].d);
+			for (k = 0; k < NSTRATEGIES; k++)
+				fprintf(fp, " %7.2f", !usable(&strategies[k]) ?
+					0 : rate(strategies[k].copy, NULL,
+						 d + offs[j].d, s + offs[j].s,
+						 sizes[i]));
+			fprintf(fp, "\n");
+		}
+	}
+
+	fprintf(fp, "\n Overlapping move, destination half the size above "
+		"the source, GB/s\n   Size  memmove  std;rep movsb\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (sizes[i] > max)
+			break;
+		print_size(fp, sizes[i]);
+		fprintf(fp, " %8.2f %14.2f\n",
+			rate(move_libc, NULL, s + sizes[i] / 2, s, sizes[i]),
+			rate(move_movsb, NULL, s + sizes[i] / 2, s, sizes[i]));
+	}
+}
+
+void memops_thresholds(struct memops_thresholds *t, size_t max, FILE *report)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	double gbs[MEMOPS_SIZES][NSTRATEGIES];
+	size_t sizes[MEMOPS_SIZES], len = max + 2 * 64;
+	uint8_t *s, *d;
+	int n;
+
+	s = mmap(NULL, 2 * len, prot, flags, -1, 0);
+	if (s == MAP_FAILED)
+		die("mmap()");
+	/* Both halves written, not backed by the shared zero page. */
+	memset(s, 1, 2 * len);
+	d = s + len;
+
+	sweep("Copy", true, d, s, max, gbs, sizes, &n, report);
+	t->rep_movsb = takes_over(gbs, sizes, n, ST_REP, vector_rival);
+	t->non_temporal = takes_over(gbs, sizes, n, ST_NT, cached_rival);
+	sweep("Set", false, d, s, max, gbs, sizes, &n, report);
+	t->rep_stosb = takes_over(gbs, sizes, n, ST_REP, vector_rival);
+	if (report)
+		alignment(d, s, max, report);
+	munmap(s, 2 * len);
+}
+
+static void crossover(const char *name, size_t from)
+{
+	if (from == MEMOPS_NEVER)
+		fprintf(stdout, "   %-13s never wins\n", name);
+	else if (!from)
+		fprintf(stdout, "   %-13s not measured\n", name);
+	else
+		fprintf(stdout, "   %-13s from %zu bytes\n", name, from);
+}
+
+void memops_benchmark(void)
+{
+	struct memops_thresholds t;
+
+	fprintf(stdout, "\nCopy and set strategies, 1 B to 1 GB\n");
+	memops_thresholds(&t, GIGABYTES(1), stdout);
+	fprintf(stdout, "\n Crossovers (L2 %zu KB, L3 %zu KB)\n",
+		cache_level_size(2) >> 10, cache_level_size(3) >> 10);
+	crossover("rep movsb", t.rep_movsb);
+	crossover("rep stosb", t.rep_stosb);
+	crossover("non-temporal", t.non_temporal);
+}
+
+/*
+ * libc memcpy/memset alone, from 1 KB to 1 GB: run it with and without
+ * GLIBC_TUNABLES to see what they change. The table is parsed back by the
+ * tunables benchmark, so it is kept to one size per line.
+ */
+void libc_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	size_t len = GIGABYTES(1), n;
+	uint8_t *s;
+
+	fprintf(stdout, "\nlibc memcpy/memset, GB/s\n"
+		"       Bytes   memcpy   memset\n");
+	s = mmap(NULL, 2 * len, prot, flags, -1, 0);
+	if (s == MAP_FAILED)
+		die("mmap()");
+	memset(s, 1, 2 * len);
+	for (n = KILOBYTES(1); n <= len; n <<= 1)
+		fprintf(stdout, " %11zu %8.2f %8.2f\n", n,
+			rate(copy_libc, NULL, s + len, s, n),
+			rate(NULL, set_libc, s + len, s, n));
+	munmap(s, 2 * len);
+}
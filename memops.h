@@ -0,0 +1,39 @@
+/*
+ * memops.h	- copy and set strategies (libc, rep movsb/stosb, vector loops,
+ * 		  non-temporal stores) and the sizes at which they take over
+ * 		  from one another.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef MEMOPS_H
+#define MEMOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The threshold of a strategy that never won over the sizes measured. */
+#define MEMOPS_NEVER	SIZE_MAX
+
+/*
+ * Sizes in bytes from which switching to a strategy pays off most over the
+ * sizes measured, MEMOPS_NEVER if it never does, 0 if it could not be
+ * measured (no ISA for it or for its rivals). The names follow the glibc
+ * tunables they correspond to.
+ */
+struct memops_thresholds {
+	size_t rep_movsb;	/* rep movsb beats the vector loops */
+	size_t rep_stosb;	/* rep stosb beats the vector loops */
+	size_t non_temporal;	/* streaming stores beat cached copies */
+};
+
+/*
+ * Time every strategy over sizes 1 B to @max bytes, print the tables to
+ * @report unless it is NULL, and store the crossover sizes in @t.
+ */
+void memops_thresholds(struct memops_thresholds *t, size_t max, FILE *report);
+
+/* @n bytes as " 512K", "   2M" or "  32G", a 6 column table cell. */
+void print_size(FILE *fp, size_t n);
+
+#endif /* MEMOPS_H */
@@ -0,0 +1,232 @@
+/*
+ * occupancy.c	- estimate how much of the LLC co-runners take, by prime and
+ * 		  probe.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * A footprint spread over all of the LLC is primed (loaded twice), left
+ * alone for an interval, and a sample of its lines is then timed: a line
+ * slower than the hit/miss threshold was evicted, by someone else's lines
+ * or by our own priming. The share evicted right away (no interval) is our
+ * own doing; what the interval adds on top of it, scaled to what was left,
+ * is taken as the share of the LLC the rest of the host pulled in during
+ * that interval.
+ *
+ * When the set index of the LLC can be computed (no slice hashing, and
+ * physical addresses or huge enough pages, see evset.h) the footprint is
+ * made of eviction sets: @ways congruent lines for a sample of sets spread
+ * evenly over the level, which fills those sets exactly. Otherwise, as on
+ * most sliced Intel LLCs, it is half the LLC worth of lines in random
+ * order, which lands evenly on the sets on average.
+ *
+ * It is a defensive measurement: it only loads and times our own memory.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "evset.h"
+
+#define OCC_SETS	1024		/* sets sampled in eviction set mode */
+#define OCC_PROBE	(1 << 14)	/* lines timed per probe, at most */
+#define OCC_ROUNDS	7		/* prime+probe rounds per interval */
+#define OCC_CAL		4		/* calibration rounds */
+
+static const unsigned occ_intervals_us[] = {
+	0, 100, 1000, 10000, 100000, 1000000
+};
+#define OCC_NINTERVALS	(sizeof(occ_intervals_us) / sizeof(occ_intervals_us[0]))
+
+struct occ {
+	uint8_t **lines;		/* primed */
+	size_t nlines;
+	uint8_t **probe;		/* timed, a sample of @lines */
+	size_t nprobe;
+	unsigned hit, miss, threshold;
+};
+
+static unsigned seed = 0x0cc;
+
+static void sleep_us(unsigned us)
+{
+	struct timespec ts = { us / 1000000, (us % 1000000) * 1000L };
+
+	if (us)
+		nanosleep(&ts, NULL);
+}
+
+/* @ways lines of every (sets / OCC_SETS)th set, in one pass over @p. */
+static size_t collect_sets(const struct evpool *p, const struct cache_info *c,
+			   uint8_t **out)
+{
+	unsigned nsets = c->sets < OCC_SETS ? c->sets : OCC_SETS;
+	unsigned stride = c->sets / nsets, *count;
+	size_t off, n = 0;
+
+	if (!(count = calloc(nsets, sizeof(*count))))
+		die("calloc()");
+	for (off = 0; off < p->size; off += c->line_size) {
+		unsigned long set = evset_index(p, c, p->base + off);
+
+		if (set % stride || set / stride >= nsets ||
+		    count[set / stride] == c->ways)
+			continue;
+		count[set / stride]++;
+		out[n++] = p->base + off;
+	}
+	free(count);
+	return n;
+}
+
+static void occ_prime(const struct occ *o)
+{
+	size_t i;
+	int r;
+
+	for (r = 0; r < 2; r++)
+		for (i = 0; i < o->nlines; i++)
+			maccess(o->lines[i]);
+}
+
+/* Fraction of the probed lines slower than the threshold. */
+static double occ_probe(const struct occ *o)
+{
+	size_t i, miss = 0;
+
+	for (i = 0; i < o->nprobe; i++)
+		if (access_latency(o->probe[i]) > o->threshold)
+			miss++;
+	return (double)miss / o->nprobe;
+}
+
+static void occ_calibrate(struct occ *o)
+{
+	unsigned *hit, *miss;
+	size_t i, n = 0;
+	int r;
+
+	hit = malloc(OCC_CAL * o->nprobe * sizeof(*hit));
+	miss = malloc(OCC_CAL * o->nprobe * sizeof(*miss));
+	if (!hit || !miss)
+		die("malloc()");
+	for (r = 0; r < OCC_CAL; r++) {
+		occ_prime(o);
+		for (i = 0; i < o->nprobe; i++)
+			hit[n + i] = access_latency(o->probe[i]);
+		for (i = 0; i < o->nprobe; i++) {
+			clflush(o->probe[i]);
+			asm volatile ("mfence" ::: "memory");
+			miss[n + i] = access_latency(o->probe[i]);
+		}
+		n += o->nprobe;
+	}
+	o->hit = median(hit, n);
+	o->miss = median(miss, n);
+	o->threshold = (o->hit + o->miss) / 2;
+	free(hit);
+	free(miss);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Median share of the probed lines evicted after @us of waiting. */
+static double occ_evicted(const struct occ *o, unsigned us)
+{
+	double f[OCC_ROUNDS];
+	int r;
+
+	for (r = 0; r < OCC_ROUNDS; r++) {
+		occ_prime(o);
+		sleep_us(us);
+		f[r] = occ_probe(o);
+	}
+	qsort(f, OCC_ROUNDS, sizeof(*f), cmp_double);
+	return f[OCC_ROUNDS / 2];
+}
+
+void occupancy_benchmark(void)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c, *llc = NULL;
+	struct evpool pool;
+	struct occ o;
+	bool sets;
+	double self;
+	unsigned level, k;
+	size_t i, pool_size;
+	int n;
+
+	fprintf(stdout, "\nLLC occupancy of co-runners, prime+probe\n");
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	for (level = 2; (c = cache_data_level(ci, n, level)); level++)
+		llc = c;
+	if (!llc) {
+		fprintf(stdout, " no shared level enumerated\n");
+		return;
+	}
+
+	/*
+	 * Eviction sets need lines of every sampled set: twice the level
+	 * gives enough of them. Otherwise half the level is primed.
+	 */
+	pool_size = 2 * llc->size;
+	if (pool_size > GIGABYTES(1))
+		pool_size = GIGABYTES(1);
+	if (evpool_init(&pool, pool_size))
+		die("evpool_init()");
+	sets = !llc->complex_indexing && evset_index_known(&pool, llc);
+	if (!sets && pool.size > llc->size / 2) {
+		evpool_destroy(&pool);
+		if (evpool_init(&pool, llc->size / 2))
+			die("evpool_init()");
+	}
+
+	memset(&o, 0, sizeof(o));
+	if (!(o.lines = malloc(pool.size / llc->line_size * sizeof(*o.lines))))
+		die("malloc()");
+	if (sets) {
+		o.nlines = collect_sets(&pool, llc, o.lines);
+	} else {
+		for (i = 0; i < pool.size; i += llc->line_size)
+			o.lines[o.nlines++] = pool.base + i;
+	}
+	/* Random order keeps the prefetchers out, for priming and probing. */
+	evset_shuffle(o.lines, o.nlines, &seed);
+	o.probe = o.lines;
+	o.nprobe = o.nlines < OCC_PROBE ? o.nlines : OCC_PROBE;
+	occ_calibrate(&o);
+
+	fprintf(stdout, " L%u %zuK, %s: %zu lines primed, %zu probed\n"
+		" hit %u, miss %u, threshold %u cycles\n", llc->level,
+		llc->size >> 10,
+		sets ? "eviction sets" : "random lines over half the level",
+		o.nlines, o.nprobe, o.hit, o.miss, o.threshold);
+	if (o.miss < o.hit + o.hit / 2) {
+		fprintf(stdout, " hits and misses do not separate, no estimate\n");
+		goto out;
+	}
+	fprintf(stdout, "   Interval  Evicted%%  Others' share  Others' KB\n");
+	self = occ_evicted(&o, 0);
+	for (k = 0; k < OCC_NINTERVALS; k++) {
+		unsigned us = occ_intervals_us[k];
+		double f = k ? occ_evicted(&o, us) : self, share;
+
+		share = self < 1 ? (f - self) / (1 - self) : 0;
+		if (share < 0)
+			share = 0;
+		fprintf(stdout, " %8.1fms %9.1f %13.1f%% %11.0f\n", us / 1000.0,
+			100 * f, 100 * share, share * (llc->size >> 10));
+	}
+out:
+	free(o.lines);
+	evpool_destroy(&pool);
+}
@@ -0,0 +1,36 @@
+/*
+ * pagemap.c	- virtual to physical address translation via
+ * 		  /proc/self/pagemap.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every virtual page has a 64 bit entry in /proc/self/pagemap:
+ * 	Bits 54 - 00: Page frame number, if present.
+ * 	Bit  63: Page present.
+ * Without CAP_SYS_ADMIN the frame number reads as 0.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pagemap.h"
+
+#define PAGEMAP_PRESENT		(1ULL << 63)
+#define PAGEMAP_PFN_MASK	((1ULL << 55) - 1)
+
+uint64_t virt_to_phys(const void *va)
+{
+	static int fd = -2;
+	const long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t entry, pfn;
+
+	if (fd == -2)
+		fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	if (pread(fd, &entry, sizeof(entry),
+		  (uintptr_t)va / page_size * sizeof(entry)) != sizeof(entry))
+		return 0;
+	if (!(entry & PAGEMAP_PRESENT) || !(pfn = entry & PAGEMAP_PFN_MASK))
+		return 0;
+	return pfn * page_size + (uintptr_t)va % page_size;
+}
@@ -0,0 +1,18 @@
+/*
+ * pagemap.h	- virtual to physical address translation via
+ * 		  /proc/self/pagemap.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+#include <stdint.h>
+
+/*
+ * Physical address backing @va, or 0 when the page is not present or the
+ * kernel hides page frame numbers from us (they need CAP_SYS_ADMIN).
+ */
+uint64_t virt_to_phys(const void *va);
+
+#endif /* PAGEMAP_H */
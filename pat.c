@@ -0,0 +1,185 @@
+/*
+ * pat.c	- load/store bandwidth and load latency of write-back,
+ * 		  write-combining, uncached and write-through memory.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The buffers come from /dev/memtype of the read-cr0 module, which maps RAM
+ * with the memory type chosen by the mmap offset (read-cr0/memtype.c).
+ * Without the module only write-back (anonymous) memory is measured.
+ *
+ * Per type: 8 byte loads, 32 byte streaming loads (movntdqa, which only
+ * WC memory really streams), 8 and 32 byte stores, 32 byte stores with an
+ * sfence every 64 bytes to 64 KB (how WC buffers are flushed towards a
+ * device ring), and the latency of dependent loads in random order. WC
+ * and UC reads bypass the caches, so their buffer is smaller to keep the
+ * run short.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "chase.h"
+#include "cpufeature.h"
+#include "util.h"
+#include "read-cr0/memtype.h"
+
+#define PAT_DEV		"/dev/memtype"
+#define PAT_SIZE	MEGABYTES(16)
+#define PAT_SIZE_SLOW	MEGABYTES(1)	/* WC/UC, their loads miss */
+#define PAT_TRIES	3
+#define PAT_CHASE	(1 << 14)
+
+/* Names of enum memtype, which is also the mmap offset in pages. */
+static const char *const pat_types[MEMTYPE_NTYPES] = {
+	[MEMTYPE_WB] = "WB",
+	[MEMTYPE_WC] = "WC",
+	[MEMTYPE_UC] = "UC",
+	[MEMTYPE_WT] = "WT",
+};
+
+static const unsigned pat_batches[] = { 64, 512, 4096, 65536 };
+#define PAT_NBATCHES	(sizeof(pat_batches) / sizeof(pat_batches[0]))
+
+static unsigned seed = 0x9a7;
+
+static void load8(uint8_t *buf, size_t size, unsigned arg)
+{
+	const volatile uint64_t *p = (const volatile uint64_t *)buf;
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < size / 8; i++)
+		sum += p[i];
+	asm volatile ("" :: "r"(sum));
+}
+
+__attribute__((target("avx2")))
+static void load_stream(uint8_t *buf, size_t size, unsigned arg)
+{
+	__m256i sum = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i < size; i += 32)
+		sum = _mm256_xor_si256(sum, _mm256_stream_load_si256(
+					       (__m256i *)(buf + i)));
+	asm volatile ("" :: "x"(sum));
+}
+
+static void store8(uint8_t *buf, size_t size, unsigned arg)
+{
+	volatile uint64_t *p = (volatile uint64_t *)buf;
+	size_t i;
+
+	for (i = 0; i < size / 8; i++)
+		p[i] = i;
+	asm volatile ("sfence" ::: "memory");
+}
+
+/* 32 byte stores, with an sfence after every @arg bytes. */
+__attribute__((target("avx2")))
+static void store32(uint8_t *buf, size_t size, unsigned arg)
+{
+	__m256i v = _mm256_set1_epi32(arg);
+	size_t i;
+
+	for (i = 0; i < size; i += 32) {
+		_mm256_store_si256((__m256i *)(buf + i), v);
+		if (!((i + 32) % arg))
+			asm volatile ("sfence" ::: "memory");
+	}
+	asm volatile ("sfence" ::: "memory");
+}
+
+/* GB/s of @fn over @size bytes of @buf, best of a few runs. */
+static double rate(void (*fn)(uint8_t *, size_t, unsigned), uint8_t *buf,
+		   size_t size, unsigned arg)
+{
+	double best = 0;
+	int t;
+
+	for (t = 0; t < PAT_TRIES; t++) {
+		double t0 = now_ns(), gbs;
+
+		fn(buf, size, arg);
+		gbs = size / (now_ns() - t0);
+		if (gbs > best)
+			best = gbs;
+	}
+	return best;
+}
+
+static void measure(const char *name, uint8_t *buf, size_t size)
+{
+	unsigned b;
+	void **p;
+
+	/* Faults every page in before anything is timed. */
+	memset(buf, 0, size);
+	fprintf(stdout, " %-3s %5zuM %7.2f", name, size >> 20,
+		rate(load8, buf, size, 0));
+	fprintf(stdout, " %7.2f", isa_level() >= ISA_AVX2 ?
+		rate(load_stream, buf, size, 0) : 0);
+	fprintf(stdout, " %7.2f", rate(store8, buf, size, 0));
+	for (b = 0; b < PAT_NBATCHES; b++)
+		fprintf(stdout, " %7.2f", isa_level() >= ISA_AVX2 ?
+			rate(store32, buf, size, pat_batches[b]) : 0);
+	p = chase_build(buf, size, 64, &seed);
+	fprintf(stdout, " %8.1f\n",
+		p ? chase_latency_ns(p, PAT_CHASE, PAT_CHASE) : 0);
+}
+
+void pat_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	unsigned t, b;
+	uint8_t *buf;
+	int fd;
+
+	fprintf(stdout, "\nMemory types, GB/s (sfence every N bytes for the "
+		"32 B stores) and load latency\n"
+		" Typ   Size   load8  ntload  store8");
+	for (b = 0; b < PAT_NBATCHES; b++) {
+		char label[16];
+
+		if (pat_batches[b] >= 1024)
+			snprintf(label, sizeof(label), "st/%uK",
+				 pat_batches[b] >> 10);
+		else
+			snprintf(label, sizeof(label), "st/%u", pat_batches[b]);
+		fprintf(stdout, " %7s", label);
+	}
+	fprintf(stdout, "  lat(ns)\n");
+
+	if ((fd = open(PAT_DEV, O_RDWR)) < 0) {
+		buf = mmap(NULL, PAT_SIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS,
+			   -1, 0);
+		if (buf == MAP_FAILED)
+			die("mmap()");
+		measure(pat_types[MEMTYPE_WB], buf, PAT_SIZE);
+		munmap(buf, PAT_SIZE);
+		fprintf(stdout, " %s not found, load read-cr0/rcr0.ko for WC, "
+			"UC and WT\n", PAT_DEV);
+		return;
+	}
+	for (t = MEMTYPE_WB; t < MEMTYPE_NTYPES; t++) {
+		size_t size = t == MEMTYPE_WC || t == MEMTYPE_UC ?
+			      PAT_SIZE_SLOW : PAT_SIZE;
+
+		buf = mmap(NULL, size, prot, MAP_SHARED, fd,
+			   (off_t)t * getpagesize());
+		if (buf == MAP_FAILED) {
+			fprintf(stdout, " %-3s not available\n", pat_types[t]);
+			continue;
+		}
+		measure(pat_types[t], buf, size);
+		munmap(buf, size);
+	}
+	close(fd);
+}
@@ -0,0 +1,241 @@
+/*
+ * prefault.c	- what it costs to fault in a buffer before using it, with
+ * 		  the ways Linux offers to do it.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * benchmark_prologue() writes one byte per page, taking one minor fault per
+ * page. The alternatives: MAP_POPULATE and MADV_POPULATE_WRITE fault the
+ * range in from the kernel in one call, first touch can be split between
+ * threads (which also places the pages on their NUMA nodes), and 2 MB pages,
+ * transparent (THP, madvise'd) or hugetlbfs, need 512 times fewer faults,
+ * though each one clears 2 MB.
+ *
+ * Each strategy maps, populates and unmaps buffers from 1 MB up to 32 GB or
+ * half of the available memory, and the setup and teardown times are
+ * reported per GB (for hugetlb, of the whole 2 MB pages mapped, one for the
+ * 1 MB row). Faulting is per process state: the rusage fault counts
+ * are printed too, to tell which strategies really faulted every page.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sysinfo.h>
+
+#include "benchmark.h"
+#include "memops.h"
+#include "topology.h"
+#include "util.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23	/* since Linux 5.14 */
+#endif
+
+#define PF_MIN		MEGABYTES(1)
+#define PF_MAX		GIGABYTES(32ULL)
+#define PF_HUGE		MEGABYTES(2)
+#define PF_MAX_THREADS	64
+
+enum pf_strategy {
+	PF_TOUCH,		/* one write per page, like benchmark_prologue() */
+	PF_POPULATE,		/* MAP_POPULATE */
+	PF_MADVISE,		/* MADV_POPULATE_WRITE */
+	PF_THREADS,		/* first touch split between threads */
+	PF_THP,			/* MADV_HUGEPAGE, then one write per 2 MB */
+	PF_HUGETLB,		/* MAP_HUGETLB, one write per 2 MB */
+	PF_NSTRATEGIES
+};
+
+static const char *const pf_names[PF_NSTRATEGIES] = {
+	[PF_TOUCH] = "touch",
+	[PF_POPULATE] = "MAP_POPULATE",
+	[PF_MADVISE] = "POPULATE_WRITE",
+	[PF_THREADS] = "threads",
+	[PF_THP] = "THP",
+	[PF_HUGETLB] = "hugetlb",
+};
+
+/* The online CPUs, one touch thread each. */
+static int pf_cpus[PF_MAX_THREADS];
+
+struct toucher {
+	uint8_t *base;
+	size_t size;
+	size_t step;
+	int cpu;
+};
+
+static void touch(uint8_t *base, size_t size, size_t step)
+{
+	size_t off;
+
+	for (off = 0; off < size; off += step)
+		((volatile uint8_t *)base)[off] = 1;
+}
+
+static void *toucher_run(void *arg)
+{
+	struct toucher *t = arg;
+
+	touch(t->base, t->size, t->step);
+	return NULL;
+}
+
+/*
+ * First touch of @size bytes at @base by one thread per online CPU. The
+ * threads start on their CPU and are SCHED_OTHER, as main is SCHED_FIFO on
+ * CPU0 and would otherwise pass both on to them.
+ */
+static void touch_threads(uint8_t *base, size_t size, int nthreads)
+{
+	struct toucher t[PF_MAX_THREADS];
+	pthread_t tid[PF_MAX_THREADS];
+	size_t chunk = (size / nthreads + PF_HUGE - 1) & ~(PF_HUGE - 1);
+	struct sched_param param = { 0 };
+	pthread_attr_t attr;
+	cpu_set_t set;
+	int i, n = 0;
+
+	for (i = 0; i < nthreads && (size_t)i * chunk < size; i++, n++) {
+		t[i].base = base + i * chunk;
+		t[i].size = size - i * chunk < chunk ? size - i * chunk : chunk;
+		t[i].step = getpagesize();
+		t[i].cpu = pf_cpus[i];
+		CPU_ZERO(&set);
+		CPU_SET(t[i].cpu, &set);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+		errno = pthread_create(&tid[i], &attr, toucher_run, &t[i]);
+		pthread_attr_destroy(&attr);
+		if (errno)
+			die("pthread_create()");
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+}
+
+/*
+ * Map and populate @size bytes with strategy @s, then unmap them. Returns
+ * -1 if the strategy is not available, 0 and the times in ns otherwise.
+ * hugetlb maps whole 2 MB pages, so @size is rounded up to one for it.
+ */
+static int run(enum pf_strategy s, size_t *size, int nthreads, double *setup,
+	       double *teardown, long *faults)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	struct rusage ru0, ru1;
+	size_t len;
+	uint8_t *buf;
+	double t0;
+
+	if (s == PF_POPULATE)
+		flags |= MAP_POPULATE;
+	/* munmap() of a hugetlb mapping fails unless 2 MB aligned. */
+	if (s == PF_HUGETLB) {
+		flags |= MAP_HUGETLB;
+		*size = (*size + PF_HUGE - 1) & ~(PF_HUGE - 1);
+	}
+	len = *size;
+	/* Room to align THP mappings to 2 MB. */
+	if (s == PF_THP)
+		len += PF_HUGE;
+
+	getrusage(RUSAGE_SELF, &ru0);
+	t0 = now_ns();
+	buf = mmap(NULL, len, prot, flags, -1, 0);
+	if (buf == MAP_FAILED)
+		return -1;
+	switch (s) {
+	case PF_TOUCH:
+		touch(buf, *size, getpagesize());
+		break;
+	case PF_POPULATE:
+		break;
+	case PF_MADVISE:
+		if (madvise(buf, *size, MADV_POPULATE_WRITE)) {
+			munmap(buf, len);
+			return -1;
+		}
+		break;
+	case PF_THREADS:
+		touch_threads(buf, *size, nthreads);
+		break;
+	case PF_THP: {
+		uint8_t *aligned = (uint8_t *)(((uintptr_t)buf + PF_HUGE - 1) &
+					       ~(PF_HUGE - 1));
+
+		if (madvise(aligned, *size, MADV_HUGEPAGE)) {
+			munmap(buf, len);
+			return -1;
+		}
+		touch(aligned, *size, PF_HUGE);
+		/* Pages THP could not back with 2 MB are still touched. */
+		touch(aligned, *size, getpagesize());
+		break;
+	}
+	case PF_HUGETLB:
+		touch(buf, *size, PF_HUGE);
+		break;
+	default:
+		break;
+	}
+	*setup = now_ns() - t0;
+	getrusage(RUSAGE_SELF, &ru1);
+	*faults = ru1.ru_minflt - ru0.ru_minflt;
+	t0 = now_ns();
+	if (munmap(buf, len))
+		die("munmap()");
+	*teardown = now_ns() - t0;
+	return 0;
+}
+
+void prefault_benchmark(void)
+{
+	size_t size, max = PF_MAX;
+	struct sysinfo si;
+	int s, cpu, nthreads = 0;
+	cpu_set_t online;
+
+	online_cpus(&online);
+	for (cpu = 0; cpu < CPU_SETSIZE && nthreads < PF_MAX_THREADS; cpu++)
+		if (CPU_ISSET(cpu, &online))
+			pf_cpus[nthreads++] = cpu;
+	if (!sysinfo(&si) && (size_t)si.freeram * si.mem_unit / 2 < max)
+		max = (size_t)si.freeram * si.mem_unit / 2;
+
+	fprintf(stdout, "\nPrefault strategies, setup/teardown ms per GB "
+		"(minor faults per MB), %d threads\n   Size", nthreads);
+	for (s = 0; s < PF_NSTRATEGIES; s++)
+		fprintf(stdout, " %17s", pf_names[s]);
+	fprintf(stdout, "\n");
+
+	for (size = PF_MIN; size <= max; size <<= 2) {
+		print_size(stdout, size);
+		for (s = 0; s < PF_NSTRATEGIES; s++) {
+			size_t mapped = size;
+			double setup, teardown, gb;
+			long faults;
+
+			if (run(s, &mapped, nthreads, &setup, &teardown,
+				&faults)) {
+				fprintf(stdout, " %17s", "n/a");
+				continue;
+			}
+			gb = (double)mapped / GIGABYTES(1);
+			fprintf(stdout, " %5.0f/%-4.0f %6.1f",
+				setup / 1e6 / gb, teardown / 1e6 / gb,
+				(double)faults / (mapped >> 20));
+		}
+		fprintf(stdout, "\n");
+	}
+}
@@ -0,0 +1,234 @@
+/**
+ * cache_bench.c	- run the benchmark kernels on a chosen cpu with
+ * 			preemption and interrupts disabled, and time them with
+ * 			the TSC.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Everything lives in /sys/kernel/debug/cache_bench:
+ *
+ *	cpu	cpu to run on
+ *	kernel	enum cache_bench_kernel
+ *	size	bytes of the buffer the kernel works on, at most buf_mb MB
+ *	step	stride in words (CB_STRIDE)
+ *	count	iterations (CB_SIZES, CB_ILP_*)
+ *	samples	timed runs, at most CB_MAX_SAMPLES
+ *	run	write anything to run the kernel
+ *	result	the parameters of the last run, its samples in TSC cycles and
+ *		a "min <> median <> max <>" line
+ *
+ * Each sample is one smp_call_function_single() with wait set: the kernel
+ * runs from the IPI (or with interrupts saved on the calling cpu), so no
+ * interrupt or preemption lands inside the timed region, and interrupts are
+ * served between samples. A sample keeps the cpu deaf for its whole
+ * duration, so keep count and size small enough to stay well below the
+ * lockup detector's threshold.
+ *
+ * The CB_WBINVD_* kernels time only the wbinvd: @size bytes of the buffer
+ * are first written (dirty) or, after a wbinvd that cleans everything,
+ * read (clean), so the sample is the cost of writing back and invalidating
+ * that footprint. wbinvd acts on every cache the cpu uses, shared levels
+ * included, so other cpus see their lines go too.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/smp.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <asm/msr.h>
+#include <asm/special_insns.h>
+
+#include "cache_bench.h"
+
+#define CB_MAX_SAMPLES	64
+
+static unsigned int buf_mb = 64;
+module_param(buf_mb, uint, 0444);
+MODULE_PARM_DESC(buf_mb, "benchmark buffer size in MB (default 64)");
+
+static const char *const cb_names[CB_NKERNELS] = {
+	[CB_STRIDE] = "stride",
+	[CB_SIZES] = "sizes",
+	[CB_ILP_SAME] = "ilp_same",
+	[CB_ILP_SPLIT] = "ilp_split",
+	[CB_WBINVD_DIRTY] = "wbinvd_dirty",
+	[CB_WBINVD_CLEAN] = "wbinvd_clean",
+};
+
+static struct dentry *cb_dir;
+static DEFINE_MUTEX(cb_lock);
+static u32 *cb_buf;
+static u64 cb_buf_size;
+
+/* Parameters, set through debugfs. */
+static u32 cb_cpu;
+static u32 cb_kernel = CB_SIZES;
+static u64 cb_size = 4096;
+static u32 cb_step = 16;
+static u64 cb_count = 1 << 20;
+static u32 cb_samples = 11;
+
+/* Last run. */
+static struct {
+	u32 cpu, kernel, step, samples;
+	u64 size, count;
+	u64 cycles[CB_MAX_SAMPLES];
+	int err;
+} cb_res = { .err = -ENODATA };
+
+static void cb_sample(void *arg)
+{
+	volatile u32 *buf = cb_buf;
+	u64 len = cb_res.size / sizeof(u32), i, t0;
+
+	switch (cb_res.kernel) {
+	case CB_WBINVD_DIRTY:
+		for (i = 0; i < len; i += 16)
+			buf[i]++;
+		break;
+	case CB_WBINVD_CLEAN:
+		wbinvd();
+		for (i = 0; i < len; i += 16)
+			(void)buf[i];
+		break;
+	}
+
+	t0 = rdtsc_ordered();
+	switch (cb_res.kernel) {
+	case CB_STRIDE:
+		for (i = 0; i < len; i += cb_res.step)
+			buf[i] *= 3;
+		break;
+	case CB_SIZES:
+		for (i = 0; i < cb_res.count; i++)
+			buf[(i * 16) & (len - 1)]++;
+		break;
+	case CB_ILP_SAME:
+		for (i = 0; i < cb_res.count; i++) {
+			buf[0]++;
+			buf[0]++;
+		}
+		break;
+	case CB_ILP_SPLIT:
+		for (i = 0; i < cb_res.count; i++) {
+			buf[0]++;
+			buf[1]++;
+		}
+		break;
+	case CB_WBINVD_DIRTY:
+	case CB_WBINVD_CLEAN:
+		wbinvd();
+		break;
+	}
+	*(u64 *)arg = rdtsc_ordered() - t0;
+}
+
+static int cb_run(void)
+{
+	u64 warm;
+	int i, err;
+
+	if (cb_kernel >= CB_NKERNELS || !cb_samples ||
+	    cb_samples > CB_MAX_SAMPLES || !cb_step)
+		return -EINVAL;
+	/* CB_SIZES masks the index, the length must be a power of two. */
+	if (cb_size < 2 * sizeof(u32) || cb_size > cb_buf_size ||
+	    (cb_kernel == CB_SIZES && !is_power_of_2(cb_size)))
+		return -EINVAL;
+	if (cb_cpu >= nr_cpu_ids || !cpu_online(cb_cpu))
+		return -ENODEV;
+
+	cb_res.cpu = cb_cpu;
+	cb_res.kernel = cb_kernel;
+	cb_res.size = cb_size;
+	cb_res.step = cb_step;
+	cb_res.count = cb_count;
+	cb_res.samples = cb_samples;
+	/* An untimed run first, to warm the caches up. */
+	err = smp_call_function_single(cb_res.cpu, cb_sample, &warm, 1);
+	for (i = 0; !err && i < cb_res.samples; i++)
+		err = smp_call_function_single(cb_res.cpu, cb_sample,
+					       &cb_res.cycles[i], 1);
+	cb_res.err = err;
+	return err;
+}
+
+static ssize_t cb_run_write(struct file *file, const char __user *ubuf,
+			    size_t len, loff_t *ppos)
+{
+	int err;
+
+	mutex_lock(&cb_lock);
+	err = cb_run();
+	mutex_unlock(&cb_lock);
+	return err ? err : len;
+}
+
+static const struct file_operations cb_run_fops = {
+	.owner	= THIS_MODULE,
+	.write	= cb_run_write,
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int cb_result_show(struct seq_file *m, void *v)
+{
+	u64 sorted[CB_MAX_SAMPLES];
+	u32 i, n;
+
+	mutex_lock(&cb_lock);
+	if (cb_res.err) {
+		seq_printf(m, "error %d\n", cb_res.err);
+		goto out;
+	}
+	n = cb_res.samples;
+	seq_printf(m, "kernel %s cpu %u size %llu step %u count %llu\n",
+		   cb_names[cb_res.kernel], cb_res.cpu, cb_res.size,
+		   cb_res.step, cb_res.count);
+	seq_puts(m, "cycles");
+	for (i = 0; i < n; i++)
+		seq_printf(m, " %llu", cb_res.cycles[i]);
+	seq_putc(m, '\n');
+	memcpy(sorted, cb_res.cycles, n * sizeof(*sorted));
+	sort(sorted, n, sizeof(*sorted), cmp_u64, NULL);
+	seq_printf(m, "min %llu median %llu max %llu\n", sorted[0],
+		   sorted[n / 2], sorted[n - 1]);
+out:
+	mutex_unlock(&cb_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cb_result);
+
+int cache_bench_init(void)
+{
+	cb_buf_size = (u64)buf_mb << 20;
+	cb_buf = vzalloc(cb_buf_size);
+	if (!cb_buf)
+		return -ENOMEM;
+
+	cb_dir = debugfs_create_dir("cache_bench", NULL);
+	debugfs_create_u32("cpu", 0644, cb_dir, &cb_cpu);
+	debugfs_create_u32("kernel", 0644, cb_dir, &cb_kernel);
+	debugfs_create_u64("size", 0644, cb_dir, &cb_size);
+	debugfs_create_u32("step", 0644, cb_dir, &cb_step);
+	debugfs_create_u64("count", 0644, cb_dir, &cb_count);
+	debugfs_create_u32("samples", 0644, cb_dir, &cb_samples);
+	debugfs_create_file("run", 0200, cb_dir, NULL, &cb_run_fops);
+	debugfs_create_file("result", 0444, cb_dir, NULL, &cb_result_fops);
+	return 0;
+}
+
+void cache_bench_exit(void)
+{
+	debugfs_remove_recursive(cb_dir);
+	vfree(cb_buf);
+}
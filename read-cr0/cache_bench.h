@@ -0,0 +1,23 @@
+/**
+ * cache_bench.h	- in-kernel runner for the cache benchmark kernels.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef CACHE_BENCH_H
+#define CACHE_BENCH_H
+
+/* Kernels, the values written to the debugfs "kernel" file. */
+enum cache_bench_kernel {
+	CB_STRIDE,		/* Example 2: buf[i] *= 3 every @step words */
+	CB_SIZES,		/* Example 3: buf[(i * 16) & (len - 1)]++ */
+	CB_ILP_SAME,		/* Example 4: buf[0]++; buf[0]++; */
+	CB_ILP_SPLIT,		/* Example 4: buf[0]++; buf[1]++; */
+	CB_WBINVD_DIRTY,	/* wbinvd after writing @size bytes */
+	CB_WBINVD_CLEAN,	/* wbinvd after reading @size clean bytes */
+	CB_NKERNELS
+};
+
+int cache_bench_init(void);
+void cache_bench_exit(void);
+
+#endif /* CACHE_BENCH_H */
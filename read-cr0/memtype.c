@@ -0,0 +1,184 @@
+/**
+ * memtype.c	- map RAM to user space as WB, WC, UC- or WT memory, to
+ * 		benchmark the memory types device rings are mapped with.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every mmap() of /dev/memtype allocates its own pages, up to max_mb MB.
+ * Mappings must be MAP_SHARED; MAP_PRIVATE is refused with EINVAL.
+ * The memory type comes from the mmap offset (see memtype.h) and is set
+ * through PAT: set_pages_array_*() changes the kernel's direct mapping of
+ * the pages and records their type, so the user mapping, whose page
+ * protection carries the same PAT bits, never aliases them with another
+ * type. The pages go back to WB and are freed when the mapping goes away.
+ *
+ * Pages are inserted on fault, so the first touch of each one costs a
+ * fault; the benchmarks touch the whole buffer before timing it.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <asm/set_memory.h>
+
+#include "memtype.h"
+
+static unsigned int max_mb = 64;
+module_param(max_mb, uint, 0444);
+MODULE_PARM_DESC(max_mb, "largest /dev/memtype mapping in MB (default 64)");
+
+struct memtype_buf {
+	enum memtype type;
+	unsigned long npages;
+	struct page **pages;
+};
+
+static int set_type(struct page **pages, unsigned long n, enum memtype type)
+{
+	switch (type) {
+	case MEMTYPE_WC:
+		return set_pages_array_wc(pages, n);
+	case MEMTYPE_UC:
+		return set_pages_array_uc(pages, n);
+	case MEMTYPE_WT:
+		return set_pages_array_wt(pages, n);
+	default:
+		return 0;
+	}
+}
+
+static pgprot_t type_prot(pgprot_t prot, enum memtype type)
+{
+	switch (type) {
+	case MEMTYPE_WC:
+		return pgprot_writecombine(prot);
+	case MEMTYPE_UC:
+		return pgprot_noncached(prot);
+	case MEMTYPE_WT:
+		return pgprot_writethrough(prot);
+	default:
+		return prot;
+	}
+}
+
+static void buf_free(struct memtype_buf *b, unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		__free_page(b->pages[i]);
+	kvfree(b->pages);
+	kfree(b);
+}
+
+static vm_fault_t memtype_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct memtype_buf *b = vma->vm_private_data;
+	unsigned long i = (vmf->address - vma->vm_start) >> PAGE_SHIFT;
+
+	if (i >= b->npages)
+		return VM_FAULT_SIGBUS;
+	return vmf_insert_pfn_prot(vma, vmf->address,
+				   page_to_pfn(b->pages[i]), vma->vm_page_prot);
+}
+
+static void memtype_close(struct vm_area_struct *vma)
+{
+	struct memtype_buf *b = vma->vm_private_data;
+
+	if (b->type != MEMTYPE_WB)
+		set_pages_array_wb(b->pages, b->npages);
+	buf_free(b, b->npages);
+}
+
+/* The pages belong to the whole mapping, it must stay in one piece. */
+static int memtype_may_split(struct vm_area_struct *vma, unsigned long addr)
+{
+	return -EINVAL;
+}
+
+/*
+ * Nor may it move: mremap() copies the vma with its private data and then
+ * closes the old one, which would free the pages the new one still maps.
+ */
+static int memtype_mremap(struct vm_area_struct *vma)
+{
+	return -EINVAL;
+}
+
+static const struct vm_operations_struct memtype_vm_ops = {
+	.fault		= memtype_fault,
+	.close		= memtype_close,
+	.may_split	= memtype_may_split,
+	.mremap		= memtype_mremap,
+};
+
+static int memtype_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	unsigned long i, n = vma_pages(vma);
+	enum memtype type = vma->vm_pgoff;
+	struct memtype_buf *b;
+	int err;
+
+	/*
+	 * A private mapping is a COW one, which a VM_PFNMAP vma must not be:
+	 * its first fault would hit the BUG_ON() in vmf_insert_pfn_prot().
+	 */
+	if (!(vma->vm_flags & VM_SHARED) || type >= MEMTYPE_NTYPES)
+		return -EINVAL;
+	if (n > ((unsigned long)max_mb << (20 - PAGE_SHIFT)))
+		return -E2BIG;
+	if (!(b = kzalloc(sizeof(*b), GFP_KERNEL)))
+		return -ENOMEM;
+	b->type = type;
+	b->npages = n;
+	b->pages = kvcalloc(n, sizeof(*b->pages), GFP_KERNEL);
+	if (!b->pages) {
+		kfree(b);
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		b->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!b->pages[i]) {
+			buf_free(b, i);
+			return -ENOMEM;
+		}
+	}
+	err = set_type(b->pages, n, type);
+	if (err) {
+		buf_free(b, n);
+		return err;
+	}
+
+	vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP |
+		     VM_DONTCOPY);
+	vma->vm_page_prot = type_prot(vm_get_page_prot(vma->vm_flags), type);
+	vma->vm_private_data = b;
+	vma->vm_ops = &memtype_vm_ops;
+	return 0;
+}
+
+static const struct file_operations memtype_fops = {
+	.owner	= THIS_MODULE,
+	.mmap	= memtype_mmap,
+};
+
+static struct miscdevice memtype_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "memtype",
+	.fops	= &memtype_fops,
+	.mode	= 0600,
+};
+
+int memtype_init(void)
+{
+	return misc_register(&memtype_dev);
+}
+
+void memtype_exit(void)
+{
+	misc_deregister(&memtype_dev);
+}
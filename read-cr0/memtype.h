@@ -0,0 +1,26 @@
+/**
+ * memtype.h	- /dev/memtype, RAM mapped to user space with a chosen
+ * 		memory type.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef MEMTYPE_H
+#define MEMTYPE_H
+
+/*
+ * Memory types, selected by the mmap offset in pages: mmap(..., MAP_SHARED,
+ * fd, MEMTYPE_WC * page_size) maps write-combining memory. Private mappings
+ * are refused.
+ */
+enum memtype {
+	MEMTYPE_WB,		/* write-back, the default for RAM */
+	MEMTYPE_WC,		/* write-combining */
+	MEMTYPE_UC,		/* uncached (UC-) */
+	MEMTYPE_WT,		/* write-through */
+	MEMTYPE_NTYPES
+};
+
+int memtype_init(void);
+void memtype_exit(void);
+
+#endif /* MEMTYPE_H */
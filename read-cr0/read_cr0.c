@@ -1,58 +1,173 @@
 /**
- * read_cr0.c	- Rudimentary module to dump the value of per-cpu cr0
- * 		registor to kernel log ring buffer.
+ * read_cr0.c	- Rudimentary module to dump the per-cpu control registers and
+ * 		model specific registers that decide how the caches behave.
  *
  * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every read of /proc/cache_ctrl collects CR0, CR4, IA32_MISC_ENABLE, the
+ * prefetcher control MSR and IA32_PAT on all online cpus at once (the
+ * calling cpu included, waiting for all of them) into per-cpu slots, then
+ * prints one line per cpu of key=value pairs:
+ *
+ *	cpu0 cr0=0x80050033 cd=0 nw=0 cr4=0x3506f0 misc_enable=0x850089
+ *	fast_strings=1 pf_ctl=0x0 l2_pf=1 l2_adj_pf=1 dcu_pf=1 dcu_ip_pf=1
+ *	pat=0x407050600070106
+ *
+ * (on one line). An MSR that faults, e.g. under a hypervisor that does not
+ * emulate it, reads as "-". Prefetchers are reported enabled (1) when their
+ * disable bit is clear.
+ *
+ * The module also carries the in-kernel benchmark runner, see
+ * cache_bench.c, and /dev/memtype, see memtype.c.
  */
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/smp.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <asm/msr.h>
+#include <asm/special_insns.h>
+
+#include "cache_bench.h"
+#include "memtype.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
+#define rdmsrl_safe	rdmsrq_safe
+#endif
+
+#define CACHE_CTRL_NAME		"cache_ctrl"
 
-#ifdef CONFIG_SMP
-static DEFINE_SPINLOCK(display_lock);
+#define MSR_MISC_ENABLE		0x1a0
+#define MSR_PREFETCH_CTL	0x1a4	/* MSR_MISC_FEATURE_CONTROL */
+#define MSR_PAT			0x277
 
-static void __read_cr0(void *nop __attribute__((__unused__)))
+/* IA32_MISC_ENABLE */
+#define MISC_FAST_STRINGS	(1ULL << 0)
+
+/* Prefetcher control, a set bit disables the prefetcher. */
+#define PF_L2_HW		(1ULL << 0)
+#define PF_L2_ADJ		(1ULL << 1)
+#define PF_DCU			(1ULL << 2)
+#define PF_DCU_IP		(1ULL << 3)
+
+struct cpu_ctrl {
+	unsigned long cr0;
+	unsigned long cr4;
+	u64 misc_enable;
+	u64 pf_ctl;
+	u64 pat;
+	bool misc_ok, pf_ok, pat_ok;
+	bool valid;
+};
+
+static DEFINE_PER_CPU(struct cpu_ctrl, cpu_ctrl);
+static DEFINE_MUTEX(collect_lock);
+
+static void __read_ctrl(void *nop __attribute__((__unused__)))
 {
-	unsigned long flags;
-	unsigned long cr0, tmp;
-	bool nw, cd;
+	struct cpu_ctrl *c = this_cpu_ptr(&cpu_ctrl);
+
+	c->cr0 = read_cr0();
+	c->cr4 = __read_cr4();
+	c->misc_ok = !rdmsrl_safe(MSR_MISC_ENABLE, &c->misc_enable);
+	c->pf_ok = !rdmsrl_safe(MSR_PREFETCH_CTL, &c->pf_ctl);
+	c->pat_ok = !rdmsrl_safe(MSR_PAT, &c->pat);
+	c->valid = true;
+}
+
+static void show_msr(struct seq_file *m, const char *name, bool ok, u64 v)
+{
+	if (ok)
+		seq_printf(m, " %s=0x%llx", name, v);
+	else
+		seq_printf(m, " %s=-", name);
+}
+
+static int cache_ctrl_show(struct seq_file *m, void *v)
+{
+	int cpu;
 
 	/*
-	 *  Not exported to modules.
-	 *
-	 *  if (idle_cpu(smp_processor_id()))
-	 *  	return
-	 */
-	spin_lock_irqsave(&display_lock, flags);
-	tmp = cr0 =  read_cr0();
-	/*
-	 * Bit 29 - Not-write through,  globally enables/disable write-through
-	 * caching.
-	 */
-	nw = ((tmp >>= 29) & 0x1);
-	/*
-	 * Cache disable, globally enables/disable the memory cache.
+	 * Serialises readers on the per-cpu slots. on_each_cpu() runs the
+	 * collector on this cpu too, and only returns once every cpu is done.
 	 */
-	cd = ((tmp >>= 1) & 0x1);
-	pr_info("Set CPU%d: (cr0 0x%lx, NW: %s, CD: %s)\n",
-			smp_processor_id(),
-			cr0, nw ?  "true" : "false",
-			cd ?  "true" : "false");
-	spin_unlock_irqrestore(&display_lock, flags);
+	mutex_lock(&collect_lock);
+	for_each_online_cpu(cpu)
+		per_cpu(cpu_ctrl, cpu).valid = false;
+	on_each_cpu(__read_ctrl, NULL, 1);
+
+	for_each_online_cpu(cpu) {
+		struct cpu_ctrl *c = per_cpu_ptr(&cpu_ctrl, cpu);
+
+		if (!c->valid)
+			continue;
+		/*
+		 * Bit 29 - Not-write through, globally enables/disable
+		 * write-through caching. Bit 30 - Cache disable, globally
+		 * enables/disable the memory cache.
+		 */
+		seq_printf(m, "cpu%d cr0=0x%lx cd=%lu nw=%lu cr4=0x%lx", cpu,
+			   c->cr0, (c->cr0 >> 30) & 1, (c->cr0 >> 29) & 1,
+			   c->cr4);
+		show_msr(m, "misc_enable", c->misc_ok, c->misc_enable);
+		if (c->misc_ok)
+			seq_printf(m, " fast_strings=%d",
+				   !!(c->misc_enable & MISC_FAST_STRINGS));
+		show_msr(m, "pf_ctl", c->pf_ok, c->pf_ctl);
+		if (c->pf_ok)
+			seq_printf(m, " l2_pf=%d l2_adj_pf=%d dcu_pf=%d "
+				   "dcu_ip_pf=%d", !(c->pf_ctl & PF_L2_HW),
+				   !(c->pf_ctl & PF_L2_ADJ),
+				   !(c->pf_ctl & PF_DCU),
+				   !(c->pf_ctl & PF_DCU_IP));
+		show_msr(m, "pat", c->pat_ok, c->pat);
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&collect_lock);
+	return 0;
+}
+
+static int cache_ctrl_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cache_ctrl_show, NULL);
 }
-#else
-static inline int __read_cr0,(void *) { return 0; }
-#endif
+
+static const struct proc_ops cache_ctrl_ops = {
+	.proc_open	= cache_ctrl_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
 
 static int __init readcr0_init(void)
 {
-	smp_call_function(__read_cr0, NULL, 0);
+	int err;
+
+	/* Root only: every read sends IPIs to all cpus and reads MSRs. */
+	if (!proc_create(CACHE_CTRL_NAME, 0400, NULL, &cache_ctrl_ops))
+		return -ENOMEM;
+	err = cache_bench_init();
+	if (err)
+		goto err_bench;
+	err = memtype_init();
+	if (err)
+		goto err_memtype;
 	return 0;
+err_memtype:
+	cache_bench_exit();
+err_bench:
+	remove_proc_entry(CACHE_CTRL_NAME, NULL);
+	return err;
 }
 
 static void __exit readcr0_exit(void)
 {
+	memtype_exit();
+	cache_bench_exit();
+	remove_proc_entry(CACHE_CTRL_NAME, NULL);
 }
 
 MODULE_LICENSE("GPL");
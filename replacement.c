@@ -0,0 +1,294 @@
+/*
+ * replacement.c	- infer the replacement policy of each data cache level.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * For every level we gather lines that all map to one set of it, plus lines
+ * that share the set of the level above but not this one. Loading the
+ * latter before each timed access makes sure the timed line is not served
+ * from an upper level, so its latency tells whether it hit in the level
+ * under test.
+ *
+ * The set is emptied (filled with our lines which are then clflush'ed) and a
+ * sequence of accesses to the congruent lines is replayed. The hit/miss
+ * pattern, majority voted over a few runs, is compared with the one
+ * predicted by sim.c for true LRU, tree PLRU, quad-age LRU and random
+ * replacement, starting from an empty set too. A cyclic walk over ways + 1
+ * lines is also run: true LRU never hits on it, and an adaptive
+ * (thrash-resistant) insertion policy hits more than any of the static
+ * policies would.
+ *
+ * Complex (sliced) LLC indexing is handled by reducing lines that share the
+ * L2 set to a minimal eviction set by timing, see evset.c. Levels beyond L1
+ * need physical addresses (root) or hugetlb pages.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "evset.h"
+#include "sim.h"
+
+#define REPL_SEQS	24	/* random sequences per level */
+#define REPL_REPS	5	/* runs of each sequence, majority voted */
+#define REPL_ROUNDS	8	/* rounds of the cyclic walk */
+#define REPL_CAL	31	/* samples for latency calibration */
+#define MAX_CONG	(2 * SIM_MAX_WAYS + 1)
+#define MAX_UPPER	(2 * SIM_MAX_WAYS)
+#define MAX_SEQ		(REPL_ROUNDS * (SIM_MAX_WAYS + 1))
+
+static const enum sim_repl policies[] = {
+	SIM_REPL_LRU, SIM_REPL_PLRU, SIM_REPL_QLRU, SIM_REPL_RANDOM
+};
+#define NPOLICIES	(sizeof(policies) / sizeof(policies[0]))
+
+struct probe {
+	const struct cache_info *c;
+	unsigned ways;
+	int nblocks;			/* lines the sequences choose from */
+	uint8_t *blocks[MAX_CONG];
+	int nscrub;
+	uint8_t *scrub[MAX_CONG];
+	int nupper;
+	uint8_t *upper[MAX_UPPER];
+	unsigned hit_lat, miss_lat, threshold;
+};
+
+static unsigned seed = 0x5eed;
+
+/* Empty the set: fill it with our lines, then flush them all. */
+static void scrub(const struct probe *pr)
+{
+	int i;
+
+	evset_traverse(pr->scrub, pr->nscrub, 2);
+	evset_traverse(pr->blocks, pr->nblocks, 1);
+	evset_traverse(pr->scrub, pr->nscrub, 1);
+	for (i = 0; i < pr->nscrub; i++)
+		clflush(pr->scrub[i]);
+	for (i = 0; i < pr->nblocks; i++)
+		clflush(pr->blocks[i]);
+	asm volatile ("mfence" ::: "memory");
+}
+
+static unsigned probe_latency(const struct probe *pr, const uint8_t *p)
+{
+	evset_traverse(pr->upper, pr->nupper, 2);
+	tlb_warm(p);
+	return access_latency(p);
+}
+
+/* Latencies of a line held by the level and of one it has evicted. */
+static void calibrate(struct probe *pr)
+{
+	unsigned hit[REPL_CAL], miss[REPL_CAL];
+	uint8_t *x = pr->blocks[0];
+	int i;
+
+	for (i = 0; i < REPL_CAL; i++) {
+		maccess(x);
+		hit[i] = probe_latency(pr, x);
+		maccess(x);
+		evset_traverse(pr->scrub, pr->nscrub, 2);
+		evset_traverse(pr->blocks + 1, pr->nblocks - 1, 2);
+		miss[i] = probe_latency(pr, x);
+	}
+	pr->hit_lat = median(hit, REPL_CAL);
+	pr->miss_lat = median(miss, REPL_CAL);
+	pr->threshold = (pr->hit_lat + pr->miss_lat) / 2;
+}
+
+static void run_sequence(const struct probe *pr, const int *seq, int len,
+			 bool *hit)
+{
+	int votes[MAX_SEQ] = { 0 };
+	int r, i;
+
+	for (r = 0; r < REPL_REPS; r++) {
+		scrub(pr);
+		for (i = 0; i < len; i++)
+			votes[i] += probe_latency(pr, pr->blocks[seq[i]]) <
+				pr->threshold;
+	}
+	for (i = 0; i < len; i++)
+		hit[i] = votes[i] * 2 > REPL_REPS;
+}
+
+static void simulate(enum sim_repl repl, unsigned ways, const int *seq,
+		     int len, bool *hit, uint64_t rng)
+{
+	struct sim_level_config cfg = {
+		.size = ways * 64, .ways = ways, .repl = repl,
+		.write_back = true, .write_allocate = true,
+	};
+	struct sim s;
+	int i;
+
+	if (sim_init(&s, &cfg, 1, 64, rng))
+		die("sim_init()");
+	for (i = 0; i < len; i++)
+		hit[i] = !sim_access(&s, (uint64_t)seq[i] * 64, false);
+	sim_destroy(&s);
+}
+
+/* Fraction of @len accesses where the simulated @repl agrees with @hit. */
+static double agreement(enum sim_repl repl, unsigned ways, const int *seq,
+			int len, const bool *hit)
+{
+	bool pred[MAX_SEQ];
+	int runs = repl == SIM_REPL_RANDOM ? 8 : 1;
+	int r, i, same = 0;
+
+	for (r = 0; r < runs; r++) {
+		simulate(repl, ways, seq, len, pred, r + 1);
+		for (i = 0; i < len; i++)
+			same += pred[i] == hit[i];
+	}
+	return (double)same / (runs * len);
+}
+
+/* Hit rate over all rounds but the first of a cyclic walk of @n lines. */
+static double cyclic_rate(const bool *hit, int n)
+{
+	int i, hits = 0;
+
+	for (i = n; i < REPL_ROUNDS * n; i++)
+		hits += hit[i];
+	return (double)hits / ((REPL_ROUNDS - 1) * n);
+}
+
+static void infer(struct probe *pr)
+{
+	const unsigned w = pr->ways;
+	double score[NPOLICIES] = { 0 }, cyc_pred[NPOLICIES];
+	bool hit[MAX_SEQ], pred[MAX_SEQ];
+	int seq[MAX_SEQ];
+	int s, i, len, best = 0, total = 0;
+	double cyc;
+	unsigned p;
+
+	calibrate(pr);
+	fprintf(stdout, " L%u %5u %7u/%-7u", pr->c->level, w, pr->hit_lat,
+		pr->miss_lat);
+	if (pr->miss_lat < pr->hit_lat + 4) {
+		fprintf(stdout, " hits and misses are not distinguishable\n");
+		return;
+	}
+
+	/* Fill the set with @w lines, then mix hits and new lines. */
+	for (s = 0; s < REPL_SEQS; s++) {
+		len = 3 * w;
+		for (i = 0; i < (int)w; i++)
+			seq[i] = i;
+		for (; i < len; i++)
+			seq[i] = rand_r(&seed) % pr->nblocks;
+		run_sequence(pr, seq, len, hit);
+		for (p = 0; p < NPOLICIES; p++)
+			score[p] += agreement(policies[p], w, seq, len, hit) *
+				len;
+		total += len;
+	}
+	for (p = 0; p < NPOLICIES; p++) {
+		score[p] /= total;
+		if (score[p] > score[best])
+			best = p;
+		fprintf(stdout, " %6.1f%%", 100.0 * score[p]);
+	}
+	fprintf(stdout, "  %-6s", sim_repl_name(policies[best]));
+
+	len = REPL_ROUNDS * (w + 1);
+	for (i = 0; i < len; i++)
+		seq[i] = i % (w + 1);
+	run_sequence(pr, seq, len, hit);
+	cyc = cyclic_rate(hit, w + 1);
+	fprintf(stdout, " %5.1f%% (", 100.0 * cyc);
+	for (p = 0; p < NPOLICIES; p++) {
+		simulate(policies[p], w, seq, len, pred, 1);
+		cyc_pred[p] = cyclic_rate(pred, w + 1);
+		fprintf(stdout, "%s%.1f%%", p ? " " : "", 100.0 * cyc_pred[p]);
+	}
+	fprintf(stdout, ")\n");
+	for (p = 0; p < NPOLICIES; p++)
+		if (cyc <= cyc_pred[p] + 0.1)
+			break;
+	if (p == NPOLICIES)
+		fprintf(stdout, "    L%u keeps part of a thrashing working set: "
+			"adaptive (thrash-resistant) insertion\n",
+			pr->c->level);
+}
+
+/*
+ * Split the congruent lines of the level between the ones the sequences
+ * choose from and the ones used to scrub the set.
+ */
+static int build(struct probe *pr, const struct evpool *pool,
+		 const struct cache_info *above)
+{
+	uint8_t *cong[2 * MAX_CONG];
+	const int w = pr->ways;
+	int n;
+
+	n = evset_build(pool, pr->c, above, cong, 2 * MAX_CONG, pr->upper,
+			&pr->nupper, above ? 2 * above->ways : 0, &seed);
+	if (n < w + 2)
+		return -1;
+	pr->nblocks = w + w / 2 + 1;
+	if (pr->nblocks > n - w / 2)
+		pr->nblocks = n - w / 2 > w + 1 ? n - w / 2 : w + 1;
+	memcpy(pr->blocks, cong, pr->nblocks * sizeof(*cong));
+	pr->nscrub = n - pr->nblocks;
+	if (pr->nscrub > 2 * w)
+		pr->nscrub = 2 * w;
+	memcpy(pr->scrub, cong + pr->nblocks, pr->nscrub * sizeof(*cong));
+	return 0;
+}
+
+void replacement_benchmark(void)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c, *above = NULL;
+	struct evpool pool;
+	size_t pool_size = 0;
+	unsigned level;
+	int n;
+
+	fprintf(stdout, "\nReplacement policy inference\n");
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	for (level = 1; (c = cache_data_level(ci, n, level)); level++)
+		pool_size = 2 * c->size;
+	if (pool_size > GIGABYTES(1))
+		pool_size = GIGABYTES(1);
+	if (evpool_init(&pool, pool_size))
+		die("evpool_init()");
+	if (!pool.pa && !pool.hugetlb)
+		fprintf(stdout, "No physical addresses (not root) nor hugetlb "
+			"pages: only L1 can be probed\n");
+
+	fprintf(stdout, " L  Ways  Hit/Miss(cyc)     lru    plru    qlru  "
+		"random  Best   Cyclic ways+1 hits (lru plru qlru random)\n");
+	for (level = 1; (c = cache_data_level(ci, n, level)); above = c, level++) {
+		struct probe *pr = calloc(1, sizeof(*pr));
+
+		if (!pr)
+			die("calloc()");
+		pr->c = c;
+		pr->ways = c->ways;
+		if (c->fully_associative || c->ways > SIM_MAX_WAYS) {
+			fprintf(stdout, " L%u %5u   skipped: associativity\n",
+				level, c->ways);
+			free(pr);
+			continue;
+		}
+		if (build(pr, &pool, above))
+			fprintf(stdout, " L%u %5u   skipped: no eviction set\n",
+				level, c->ways);
+		else
+			infer(pr);
+		free(pr);
+	}
+	evpool_destroy(&pool);
+}
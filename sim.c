@@ -0,0 +1,487 @@
+/*
+ * sim.c	- trace-driven set-associative cache hierarchy simulator.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every level is a physically indexed array of @sets * @ways line tags. The
+ * set index is the line address modulo the number of sets, so the complex
+ * (hashed) indexing reported by leaf 04H EDX[2] for the LLC is not modelled;
+ * results for such a level are only indicative of its capacity behaviour.
+ *
+ * A lookup walks the levels from L1 downwards until it hits. The line is then
+ * filled into every level above the hit except exclusive (victim) levels,
+ * which only receive lines evicted from the level right above them and give
+ * them up again when they hit. Evictions from an inclusive level
+ * back-invalidate the copies held by the levels above it, and dirty lines
+ * are written back to the next level that holds the line, or to memory.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cacheinfo.h"
+#include "sim.h"
+
+#define SIM_INVALID	UINT64_MAX
+
+static const char *repl_names[] = { "lru", "plru", "random", "qlru", NULL };
+static const char *incl_names[] = { "nine", "inclusive", "exclusive", NULL };
+
+const char *sim_repl_name(enum sim_repl repl)
+{
+	return repl_names[repl];
+}
+
+const char *sim_incl_name(enum sim_incl incl)
+{
+	return incl_names[incl];
+}
+
+static int parse_name(const char **names, const char *name)
+{
+	int i;
+
+	for (i = 0; names[i]; i++)
+		if (!strcmp(names[i], name))
+			return i;
+	return -1;
+}
+
+int sim_repl_parse(const char *name)
+{
+	return parse_name(repl_names, name);
+}
+
+int sim_incl_parse(const char *name)
+{
+	return parse_name(incl_names, name);
+}
+
+static inline uint64_t sim_random(struct sim *s)
+{
+	/* xorshift64 */
+	s->rng ^= s->rng << 13;
+	s->rng ^= s->rng >> 7;
+	s->rng ^= s->rng << 17;
+	return s->rng;
+}
+
+static inline unsigned plru_span(unsigned ways)
+{
+	unsigned span = 1;
+
+	while (span < ways)
+		span <<= 1;
+	return span;
+}
+
+/*
+ * Tree PLRU over the next power of 2 of @ways leaves. Node n has children
+ * 2n + 1 and 2n + 2, a set bit points the victim search to the right.
+ */
+static inline void plru_touch(uint64_t *tree, unsigned ways, unsigned way)
+{
+	unsigned node = 0, lo = 0, span = plru_span(ways);
+
+	while (span > 1) {
+		span >>= 1;
+		if (way < lo + span) {
+			*tree |= 1ULL << node;
+			node = 2 * node + 1;
+		} else {
+			*tree &= ~(1ULL << node);
+			lo += span;
+			node = 2 * node + 2;
+		}
+	}
+}
+
+static inline unsigned plru_victim(uint64_t tree, unsigned ways)
+{
+	unsigned node = 0, lo = 0, span = plru_span(ways);
+
+	while (span > 1) {
+		span >>= 1;
+		/* Subtrees made only of padding leaves are never chosen. */
+		if ((tree >> node) & 1 && lo + span < ways) {
+			lo += span;
+			node = 2 * node + 2;
+		} else {
+			node = 2 * node + 1;
+		}
+	}
+	return lo;
+}
+
+static inline unsigned set_of(const struct sim_level *l, uint64_t line)
+{
+	if (l->set_mask)
+		return line & l->set_mask;
+	return line % l->sets;
+}
+
+/* Return the slot holding @line or -1. */
+static inline long lookup(const struct sim_level *l, uint64_t line)
+{
+	const unsigned ways = l->cfg.ways;
+	const size_t base = (size_t)set_of(l, line) * ways;
+	unsigned w;
+
+	for (w = 0; w < ways; w++)
+		if (l->tags[base + w] == line)
+			return base + w;
+	return -1;
+}
+
+/* Update the replacement state for a hit on, or a @fill of, @slot. */
+static inline void touch(struct sim *s, struct sim_level *l, size_t slot,
+			 bool fill)
+{
+	const unsigned ways = l->cfg.ways;
+
+	switch (l->cfg.repl) {
+	case SIM_REPL_QLRU:
+		l->age[slot] = fill ? 2 : 0;
+		break;
+	case SIM_REPL_LRU:
+		l->stamp[slot] = ++s->clock;
+		break;
+	case SIM_REPL_PLRU:
+		plru_touch(&l->plru[slot / ways], ways, slot % ways);
+		break;
+	case SIM_REPL_RANDOM:
+		break;
+	}
+}
+
+static size_t victim(struct sim *s, struct sim_level *l, unsigned set)
+{
+	const unsigned ways = l->cfg.ways;
+	const size_t base = (size_t)set * ways;
+	size_t slot;
+	unsigned w;
+
+	for (w = 0; w < ways; w++)
+		if (l->tags[base + w] == SIM_INVALID)
+			return base + w;
+
+	switch (l->cfg.repl) {
+	case SIM_REPL_LRU:
+		slot = base;
+		for (w = 1; w < ways; w++)
+			if (l->stamp[base + w] < l->stamp[slot])
+				slot = base + w;
+		return slot;
+	case SIM_REPL_PLRU:
+		return base + plru_victim(l->plru[set], ways);
+	case SIM_REPL_QLRU:
+		/* Age everybody until a line reaches 3, take the first one. */
+		for (;;) {
+			for (w = 0; w < ways; w++)
+				if (l->age[base + w] == 3)
+					return base + w;
+			for (w = 0; w < ways; w++)
+				l->age[base + w]++;
+		}
+	case SIM_REPL_RANDOM:
+	default:
+		return base + sim_random(s) % ways;
+	}
+}
+
+static void fill(struct sim *s, int j, uint64_t line, bool dirty);
+
+/* Send a dirty line down, starting at level @from. */
+static void writeback(struct sim *s, int from, uint64_t line)
+{
+	int k;
+
+	for (k = from; k < s->nlevels; k++) {
+		struct sim_level *l = &s->level[k];
+		long slot = lookup(l, line);
+
+		if (slot < 0)
+			continue;
+		if (l->cfg.write_back) {
+			l->dirty[slot] = 1;
+			return;
+		}
+	}
+	s->mem_writes++;
+}
+
+/* @line has left level @j, carrying @dirty data. */
+static void evict(struct sim *s, int j, uint64_t line, bool dirty)
+{
+	struct sim_level *l = &s->level[j];
+	int k;
+
+	l->stats.evictions++;
+	if (j > 0 && l->cfg.incl == SIM_INCL_INCLUSIVE) {
+		for (k = 0; k < j; k++) {
+			struct sim_level *u = &s->level[k];
+			long slot = lookup(u, line);
+
+			if (slot < 0)
+				continue;
+			dirty |= u->dirty[slot];
+			u->tags[slot] = SIM_INVALID;
+			u->dirty[slot] = 0;
+			l->stats.back_invalidations++;
+		}
+	}
+	if (j + 1 < s->nlevels && s->level[j + 1].cfg.incl == SIM_INCL_EXCLUSIVE) {
+		if (dirty)
+			l->stats.writebacks++;
+		fill(s, j + 1, line, dirty);
+		return;
+	}
+	if (dirty) {
+		l->stats.writebacks++;
+		writeback(s, j + 1, line);
+	}
+}
+
+static void fill(struct sim *s, int j, uint64_t line, bool dirty)
+{
+	struct sim_level *l = &s->level[j];
+	long slot = lookup(l, line);
+	uint64_t old;
+	bool old_dirty;
+
+	if (slot >= 0) {
+		l->dirty[slot] |= dirty;
+		touch(s, l, slot, false);
+		return;
+	}
+	slot = victim(s, l, set_of(l, line));
+	old = l->tags[slot];
+	old_dirty = l->dirty[slot];
+	l->tags[slot] = SIM_INVALID;
+	l->dirty[slot] = 0;
+	if (old != SIM_INVALID)
+		evict(s, j, old, old_dirty);
+	l->tags[slot] = line;
+	l->dirty[slot] = dirty;
+	touch(s, l, slot, true);
+}
+
+static inline bool fills(const struct sim *s, int j, bool write)
+{
+	const struct sim_level_config *cfg = &s->level[j].cfg;
+
+	if (j > 0 && cfg->incl == SIM_INCL_EXCLUSIVE)
+		return false;
+	return !write || cfg->write_allocate;
+}
+
+int sim_access(struct sim *s, uint64_t addr, bool write)
+{
+	const uint64_t line = addr >> s->line_shift;
+	bool dirty = false;
+	long slot = -1;
+	int h, j, lowest;
+
+	for (h = 0; h < s->nlevels; h++) {
+		struct sim_stats *st = &s->level[h].stats;
+
+		if (write)
+			st->writes++;
+		else
+			st->reads++;
+		slot = lookup(&s->level[h], line);
+		if (slot >= 0)
+			break;
+		if (write)
+			st->write_misses++;
+		else
+			st->read_misses++;
+	}
+
+	/* The lowest level above the hit that takes a copy of the line. */
+	for (lowest = h - 1; lowest >= 0; lowest--)
+		if (fills(s, lowest, write))
+			break;
+
+	if (h == s->nlevels) {
+		if (lowest >= 0)
+			s->mem_reads++;
+	} else {
+		struct sim_level *l = &s->level[h];
+
+		touch(s, l, slot, false);
+		if (h > 0 && l->cfg.incl == SIM_INCL_EXCLUSIVE && lowest >= 0) {
+			dirty = l->dirty[slot];
+			l->tags[slot] = SIM_INVALID;
+			l->dirty[slot] = 0;
+		}
+	}
+
+	for (j = lowest; j >= 0; j--) {
+		if (!fills(s, j, write))
+			continue;
+		fill(s, j, line, j == lowest && dirty);
+	}
+
+	if (write)
+		writeback(s, 0, line);
+	return h;
+}
+
+void sim_reset(struct sim *s)
+{
+	int i;
+
+	for (i = 0; i < s->nlevels; i++) {
+		struct sim_level *l = &s->level[i];
+		size_t lines = (size_t)l->sets * l->cfg.ways;
+
+		memset(l->tags, 0xff, lines * sizeof(*l->tags));
+		memset(l->dirty, 0, lines);
+		if (l->stamp)
+			memset(l->stamp, 0, lines * sizeof(*l->stamp));
+		if (l->plru)
+			memset(l->plru, 0, l->sets * sizeof(*l->plru));
+		if (l->age)
+			memset(l->age, 3, lines);
+		memset(&l->stats, 0, sizeof(l->stats));
+	}
+	s->clock = 0;
+	s->mem_reads = s->mem_writes = 0;
+}
+
+void sim_destroy(struct sim *s)
+{
+	int i;
+
+	for (i = 0; i < s->nlevels; i++) {
+		free(s->level[i].tags);
+		free(s->level[i].stamp);
+		free(s->level[i].plru);
+		free(s->level[i].age);
+		free(s->level[i].dirty);
+	}
+	s->nlevels = 0;
+}
+
+int sim_init(struct sim *s, const struct sim_level_config *cfg, int n,
+	     unsigned line_size, uint64_t seed)
+{
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if (n < 1 || n > SIM_MAX_LEVELS || !line_size ||
+	    (line_size & (line_size - 1)))
+		goto einval;
+	s->line_shift = __builtin_ctz(line_size);
+	s->rng = seed ? seed : 0x9e3779b97f4a7c15ULL;
+
+	for (i = 0; i < n; i++) {
+		struct sim_level *l = &s->level[i];
+		size_t lines;
+
+		l->cfg = cfg[i];
+		if (!cfg[i].ways || cfg[i].ways > SIM_MAX_WAYS ||
+		    cfg[i].size % ((size_t)cfg[i].ways * line_size))
+			goto einval;
+		l->sets = cfg[i].size / ((size_t)cfg[i].ways * line_size);
+		if (!l->sets)
+			goto einval;
+		/* A single set keeps a zero mask and takes the modulo path. */
+		if (!(l->sets & (l->sets - 1)))
+			l->set_mask = l->sets - 1;
+		lines = (size_t)l->sets * cfg[i].ways;
+		s->nlevels = i + 1;
+		l->tags = malloc(lines * sizeof(*l->tags));
+		l->dirty = malloc(lines);
+		if (cfg[i].repl == SIM_REPL_LRU)
+			l->stamp = malloc(lines * sizeof(*l->stamp));
+		if (cfg[i].repl == SIM_REPL_PLRU)
+			l->plru = malloc(l->sets * sizeof(*l->plru));
+		if (cfg[i].repl == SIM_REPL_QLRU)
+			l->age = malloc(lines);
+		if (!l->tags || !l->dirty ||
+		    (cfg[i].repl == SIM_REPL_LRU && !l->stamp) ||
+		    (cfg[i].repl == SIM_REPL_PLRU && !l->plru) ||
+		    (cfg[i].repl == SIM_REPL_QLRU && !l->age)) {
+			sim_destroy(s);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	sim_reset(s);
+	return 0;
+einval:
+	sim_destroy(s);
+	errno = EINVAL;
+	return -1;
+}
+
+int sim_config_from_host(struct sim_level_config *cfg, int max,
+			 enum sim_repl repl, unsigned *line_size)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *c;
+	unsigned level;
+	int n, i = 0;
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	*line_size = 64;
+	for (level = 1; i < max; level++) {
+		if (!(c = cache_data_level(ci, n, level)))
+			break;
+		if (level == 1)
+			*line_size = c->line_size;
+		cfg[i].size = c->size;
+		cfg[i].ways = c->fully_associative ?
+			c->size / c->line_size : c->ways;
+		cfg[i].repl = repl;
+		cfg[i].incl = c->inclusive && level > 1 ?
+			SIM_INCL_INCLUSIVE : SIM_INCL_NINE;
+		cfg[i].write_back = true;
+		cfg[i].write_allocate = true;
+		i++;
+	}
+	return i;
+}
+
+static void print_size(FILE *fp, size_t bytes)
+{
+	static const char *prefix[] = { "", "k", "M", "G" };
+	int p = 0;
+
+	while (p < 3 && bytes && !(bytes & 1023)) {
+		bytes >>= 10;
+		p++;
+	}
+	fprintf(fp, "%6zu%-1s", bytes, prefix[p]);
+}
+
+void sim_report(const struct sim *s, FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "| L |  Size  | Ways |  Sets  |  Repl  |   Incl    | "
+		"    Accesses |       Misses |  Miss%% |   Writebacks |"
+		"   Back-inv\n");
+	for (i = 0; i < s->nlevels; i++) {
+		const struct sim_level *l = &s->level[i];
+		const struct sim_stats *st = &l->stats;
+		uint64_t acc = st->reads + st->writes;
+		uint64_t miss = st->read_misses + st->write_misses;
+
+		fprintf(fp, " L%d ", i + 1);
+		print_size(fp, l->cfg.size);
+		fprintf(fp, " %6u %8u %8s %11s %14llu %14llu %7.2f%% %14llu "
+			"%12llu\n",
+			l->cfg.ways, l->sets, sim_repl_name(l->cfg.repl),
+			i ? sim_incl_name(l->cfg.incl) : "-",
+			(unsigned long long)acc, (unsigned long long)miss,
+			acc ? 100.0 * miss / acc : 0.0,
+			(unsigned long long)st->writebacks,
+			(unsigned long long)st->back_invalidations);
+	}
+	fprintf(fp, "Memory: reads %llu, writes %llu\n",
+		(unsigned long long)s->mem_reads,
+		(unsigned long long)s->mem_writes);
+}
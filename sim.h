@@ -0,0 +1,105 @@
+/*
+ * sim.h	- trace-driven set-associative cache hierarchy simulator.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_MAX_LEVELS	4
+#define SIM_MAX_WAYS	64
+
+enum sim_repl {
+	SIM_REPL_LRU,		/* true LRU */
+	SIM_REPL_PLRU,		/* tree pseudo-LRU */
+	SIM_REPL_RANDOM,
+	SIM_REPL_QLRU,		/* quad-age LRU: 2 bit ages, insert at 2 */
+};
+
+/*
+ * Relation of a level to the levels above it (closer to the core). It has no
+ * meaning for the first level.
+ */
+enum sim_incl {
+	SIM_INCL_NINE,		/* non-inclusive, non-exclusive */
+	SIM_INCL_INCLUSIVE,	/* evictions back-invalidate upper levels */
+	SIM_INCL_EXCLUSIVE,	/* victim cache, filled by upper evictions */
+};
+
+struct sim_level_config {
+	size_t size;
+	unsigned ways;
+	enum sim_repl repl;
+	enum sim_incl incl;
+	bool write_back;	/* else write-through */
+	bool write_allocate;	/* else no-write-allocate */
+};
+
+struct sim_stats {
+	uint64_t reads, writes;
+	uint64_t read_misses, write_misses;
+	uint64_t writebacks;		/* dirty lines sent down */
+	uint64_t evictions;
+	uint64_t back_invalidations;	/* lines removed from upper levels */
+};
+
+struct sim_level {
+	struct sim_level_config cfg;
+	unsigned sets;
+	uint64_t set_mask;		/* sets - 1 when sets is a power of 2 */
+	uint64_t *tags;			/* sets * ways, SIM_INVALID if empty */
+	uint64_t *stamp;		/* LRU timestamps */
+	uint64_t *plru;			/* one tree per set */
+	uint8_t *age;			/* QLRU ages */
+	uint8_t *dirty;
+	struct sim_stats stats;
+};
+
+struct sim {
+	int nlevels;
+	unsigned line_shift;
+	uint64_t clock;
+	uint64_t rng;
+	uint64_t mem_reads, mem_writes;
+	struct sim_level level[SIM_MAX_LEVELS];
+};
+
+/*
+ * Build a hierarchy of @n levels with @line_size byte lines. Returns 0 or -1
+ * with errno set (EINVAL for a bad geometry, ENOMEM).
+ */
+int sim_init(struct sim *s, const struct sim_level_config *cfg, int n,
+	     unsigned line_size, uint64_t seed);
+void sim_destroy(struct sim *s);
+
+/*
+ * Simulate one load or store to @addr. Returns the index of the level that
+ * hit, or s->nlevels if the line came from memory.
+ */
+int sim_access(struct sim *s, uint64_t addr, bool write);
+
+/* Invalidate every level and clear the statistics. */
+void sim_reset(struct sim *s);
+
+/*
+ * Fill @cfg with the data/unified levels enumerated on this host (write-back,
+ * write-allocate, @repl replacement; inclusiveness from CPUID EDX[1]).
+ * Returns the number of levels and stores the L1D line size in @line_size.
+ */
+int sim_config_from_host(struct sim_level_config *cfg, int max,
+			 enum sim_repl repl, unsigned *line_size);
+
+void sim_report(const struct sim *s, FILE *fp);
+
+const char *sim_repl_name(enum sim_repl repl);
+const char *sim_incl_name(enum sim_incl incl);
+/* Parse a policy name, returns -1 if unknown. */
+int sim_repl_parse(const char *name);
+int sim_incl_parse(const char *name);
+
+#endif /* SIM_H */
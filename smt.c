@@ -0,0 +1,248 @@
+/*
+ * smt.c	- what two hardware threads of one core cost each other, next
+ * 		  to two threads on separate cores, per kind of workload.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Four kernels, each run by one thread alone on CPU0, then by two threads
+ * at once on CPU0 and its SMT sibling, then on CPU0 and a CPU of another
+ * core of the same package:
+ *
+ *	compute	four independent multiply-add chains, execution port bound
+ *	l1	sequential 8 byte loads over half of L1D per thread
+ *	l2	random dependent loads over half of L2 per thread
+ *	memory	random dependent loads over 256 MB per thread
+ *
+ * Siblings share the core's ports and its L1D and L2, so the L1 and L2
+ * kernels of two siblings fight over a level sized for one of them, and
+ * the compute kernel over the ports; the memory kernel mostly waits, which
+ * is what SMT hides. Each thread runs for a fixed time and counts its
+ * units of work. The slowdown is per thread against the thread alone; the
+ * aggregate is both threads' work over the work of one thread alone, the
+ * gain (or loss) from putting a second thread there.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "chase.h"
+#include "topology.h"
+#include "util.h"
+
+#define SMT_NS		300e6	/* run time of each thread */
+#define SMT_CHUNK	4096	/* units between clock reads */
+#define SMT_MEM		MEGABYTES(256)
+
+enum smt_kernel { SMT_COMPUTE, SMT_L1, SMT_L2, SMT_MEM_CHASE, SMT_NKERNELS };
+
+static const char *const smt_names[SMT_NKERNELS] = {
+	"compute", "l1", "l2", "memory",
+};
+
+struct smt_thread {
+	int cpu;
+	enum smt_kernel kernel;
+	uint8_t *buf;
+	size_t size;
+	void **chase;
+	volatile int *go;
+	int nthreads;
+	double rate;			/* units per us */
+};
+
+static unsigned seed = 0x5e7;
+
+/* Run @kernel for SMT_CHUNK units, return something to keep alive. */
+static uint64_t chunk(struct smt_thread *t, size_t *pos)
+{
+	uint64_t a = *pos, b = a + 1, c = a + 2, d = a + 3, sum = 0;
+	const uint64_t *p = (const uint64_t *)t->buf;
+	size_t n = t->size / sizeof(uint64_t), i;
+
+	switch (t->kernel) {
+	case SMT_COMPUTE:
+		for (i = 0; i < SMT_CHUNK; i++) {
+			a = a * 6364136223846793005ULL + 1442695040888963407ULL;
+			b = b * 6364136223846793005ULL + 1442695040888963407ULL;
+			c = c * 6364136223846793005ULL + 1442695040888963407ULL;
+			d = d * 6364136223846793005ULL + 1442695040888963407ULL;
+		}
+		sum = a ^ b ^ c ^ d;
+		break;
+	case SMT_L1:
+		for (i = 0; i < SMT_CHUNK; i++) {
+			sum += ((const volatile uint64_t *)p)[*pos];
+			*pos = *pos + 1 < n ? *pos + 1 : 0;
+		}
+		break;
+	case SMT_L2:
+	case SMT_MEM_CHASE:
+		t->chase = chase_run(t->chase, SMT_CHUNK);
+		sum = (uintptr_t)t->chase;
+		break;
+	default:
+		break;
+	}
+	return sum;
+}
+
+static void *smt_run(void *arg)
+{
+	struct smt_thread *t = arg;
+	unsigned long long units = 0;
+	uint64_t sum = 0;
+	size_t pos = 0;
+	double start, stop;
+
+	__sync_fetch_and_add(t->go, 1);
+	while (*t->go < t->nthreads)
+		;
+	start = now_ns();
+	do {
+		sum += chunk(t, &pos);
+		units += SMT_CHUNK;
+	} while ((stop = now_ns()) - start < SMT_NS);
+	asm volatile ("" :: "r"(sum));
+	t->rate = units / ((stop - start) / 1e3);
+	return NULL;
+}
+
+/*
+ * Run @kernel on @n threads on @cpus at once (main is SCHED_FIFO on CPU0,
+ * the threads are SCHED_OTHER so it can still get in to start them) and
+ * store each thread's rate in @rate.
+ */
+static void run(enum smt_kernel kernel, struct smt_thread *t, const int *cpus,
+		int n, double *rate)
+{
+	volatile int go = 0;
+	pthread_t th[2];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct sched_param param = { 0 };
+		pthread_attr_t attr;
+		cpu_set_t set;
+
+		t[i].cpu = cpus[i];
+		t[i].kernel = kernel;
+		t[i].go = &go;
+		t[i].nthreads = n;
+		CPU_ZERO(&set);
+		CPU_SET(cpus[i], &set);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+		errno = pthread_create(&th[i], &attr, smt_run, &t[i]);
+		pthread_attr_destroy(&attr);
+		if (errno)
+			die("pthread_create()");
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(th[i], NULL);
+		rate[i] = t[i].rate;
+	}
+}
+
+/* Give each thread its own buffer for @kernel. */
+static void prepare(enum smt_kernel kernel, struct smt_thread *t,
+		    uint8_t *const *bufs)
+{
+	size_t size = 0;
+	int i;
+
+	switch (kernel) {
+	case SMT_L1:
+		size = cache_level_size(1) / 2;
+		break;
+	case SMT_L2:
+		size = cache_level_size(2) / 2;
+		break;
+	case SMT_MEM_CHASE:
+		size = SMT_MEM;
+		break;
+	default:
+		size = 4096;
+	}
+	if (!size)
+		size = 4096;
+	for (i = 0; i < 2; i++) {
+		t[i].buf = bufs[i];
+		t[i].size = size;
+		if (kernel != SMT_L2 && kernel != SMT_MEM_CHASE)
+			continue;
+		t[i].chase = chase_build(bufs[i], size, 64, &seed);
+		if (!t[i].chase)
+			die("chase_build()");
+	}
+}
+
+static void print_pair(const double *r, double alone)
+{
+	if (r[0] <= 0) {
+		fprintf(stdout, " %8s %8s %8s %8s", "-", "-", "-", "-");
+		return;
+	}
+	fprintf(stdout, " %8.0f %8.0f %7.2fx %7.2fx", r[0], r[1],
+		alone / ((r[0] + r[1]) / 2), (r[0] + r[1]) / alone);
+}
+
+void smt_benchmark(void)
+{
+	const int prot = PROT_READ | PROT_WRITE;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	int sib = core_peer(0, true), other = core_peer(0, false);
+	int pair_sib[2] = { 0, sib }, pair_other[2] = { 0, other };
+	struct smt_thread t[2];
+	uint8_t *bufs[2];
+	unsigned k;
+	int i;
+
+	fprintf(stdout, "\nSMT siblings vs separate cores, units of work per "
+		"us per thread\n");
+	if (sib >= 0)
+		fprintf(stdout, " CPU0 sibling: CPU%d\n", sib);
+	if (other >= 0)
+		fprintf(stdout, " CPU0 other core: CPU%d\n", other);
+	for (i = 0; i < 2; i++) {
+		bufs[i] = mmap(NULL, SMT_MEM, prot, flags, -1, 0);
+		if (bufs[i] == MAP_FAILED)
+			die("mmap()");
+		memset(bufs[i], 1, SMT_MEM);
+	}
+	fprintf(stdout, " Kernel     alone   sib t0   sib t1     slow     aggr"
+		"  core t0  core t1     slow     aggr\n");
+	for (k = 0; k < SMT_NKERNELS; k++) {
+		double alone, sr[2] = { 0 }, cr[2] = { 0 };
+
+		memset(t, 0, sizeof(t));
+		prepare(k, t, bufs);
+		run(k, t, pair_sib, 1, &alone);
+		if (sib >= 0) {
+			prepare(k, t, bufs);
+			run(k, t, pair_sib, 2, sr);
+		}
+		if (other >= 0) {
+			prepare(k, t, bufs);
+			run(k, t, pair_other, 2, cr);
+		}
+		fprintf(stdout, " %-8s %7.0f", smt_names[k], alone);
+		print_pair(sr, alone);
+		print_pair(cr, alone);
+		fputc('\n', stdout);
+	}
+	if (sib < 0 || other < 0)
+		fprintf(stdout, " Pairs need an SMT sibling and another core "
+			"of CPU0's package\n");
+	for (i = 0; i < 2; i++)
+		munmap(bufs[i], SMT_MEM);
+}
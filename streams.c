@@ -0,0 +1,126 @@
+/*
+ * streams.c	- bandwidth of 1 to 64 sequential read streams interleaved by
+ * 		  one thread, to see how many the prefetchers keep track of.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * The footprint, 4 times the LLC (at least 64 MB, at most 512 MB), is cut
+ * into as many regions as there are streams and the thread reads one line
+ * of each region in turn, moving every stream forward by a line per round,
+ * as a scan of that many columns does. Regions start on distinct pages,
+ * shifted by one line per stream so that the streams do not all fall into
+ * the same L1 set. While the L2 streamer tracks every stream, the aggregate
+ * bandwidth holds; once there are more streams than it has trackers, some
+ * of them miss without a prefetch ahead and the bandwidth falls.
+ *
+ * The result is the largest count that keeps 90% of the best bandwidth,
+ * how many columns a thread can scan at once.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "trace.h"
+#include "util.h"
+
+#define ST_MAX_STREAMS	64
+#define ST_MIN		MEGABYTES(64)
+#define ST_MAX		MEGABYTES(512)
+#define ST_TRIES	3
+#define ST_PAGE		4096
+
+static const unsigned st_counts[] = {
+	1, 2, 3, 4, 6, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 56, 64
+};
+#define ST_NCOUNTS	(sizeof(st_counts) / sizeof(st_counts[0]))
+
+/* Read @lines lines of each of the @n streams, one line of each per round. */
+static uint64_t read_streams(const uint64_t *const *s, unsigned n,
+			     size_t lines)
+{
+	uint64_t sum = 0;
+	size_t i;
+	unsigned k;
+
+	for (i = 0; i < lines * 8; i += 8)
+		for (k = 0; k < n; k++) {
+			const uint64_t *p = s[k] + i;
+#ifdef CONFIG_TRACE
+			unsigned j;
+
+			for (j = 0; j < 8; j++)
+				TRACE_LOAD(p + j);
+#endif
+			sum += p[0] + p[1] + p[2] + p[3] +
+			       p[4] + p[5] + p[6] + p[7];
+		}
+	return sum;
+}
+
+/* GB/s of @n streams over @buf[0, @size), best of a few runs. */
+static double bandwidth(uint8_t *buf, size_t size, unsigned n)
+{
+	const uint64_t *s[ST_MAX_STREAMS];
+	size_t region = size / n / ST_PAGE * ST_PAGE, lines;
+	double best = 0;
+	uint64_t sum = 0;
+	unsigned k;
+	int t;
+
+	/* The last line of shift keeps every stream inside its region. */
+	lines = (region - ST_MAX_STREAMS * 64) / 64;
+	for (k = 0; k < n; k++)
+		s[k] = (const uint64_t *)(buf + k * region +
+					  (k * 64) % ST_PAGE);
+	for (t = 0; t < ST_TRIES; t++) {
+		double t0 = now_ns(), gbs;
+
+		sum += read_streams(s, n, lines);
+		gbs = (double)lines * 64 * n / (now_ns() - t0);
+		if (gbs > best)
+			best = gbs;
+	}
+	asm volatile ("" :: "r"(sum));
+	return best;
+}
+
+void streams_benchmark(void)
+{
+	size_t llc = cache_level_size(3), size;
+	double gbs[ST_NCOUNTS];
+	unsigned i, best = 0, keep;
+	uint8_t *buf;
+
+	if (!llc)
+		llc = cache_level_size(2);
+	size = 4 * llc < ST_MAX ? 4 * llc : ST_MAX;
+	if (size < ST_MIN)
+		size = ST_MIN;
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap()");
+	memset(buf, 1, size);
+
+	fprintf(stdout, "\nConcurrent sequential read streams, one thread, "
+		"%zuM footprint\n Streams   GB/s  of best\n", size >> 20);
+	for (i = 0; i < ST_NCOUNTS; i++) {
+		gbs[i] = bandwidth(buf, size, st_counts[i]);
+		if (gbs[i] > gbs[best])
+			best = i;
+	}
+	for (i = 0; i < ST_NCOUNTS; i++)
+		fprintf(stdout, " %7u %6.2f %7.0f%%\n", st_counts[i], gbs[i],
+			100 * gbs[i] / gbs[best]);
+	/* From the best count on, as long as 90% of it holds. */
+	for (keep = best; keep + 1 < ST_NCOUNTS; keep++)
+		if (gbs[keep + 1] < 0.9 * gbs[best])
+			break;
+	fprintf(stdout, " Up to %u streams keep 90%% of the best bandwidth "
+		"(%u streams, %.2f GB/s)\n", st_counts[keep], st_counts[best],
+		gbs[best]);
+	munmap(buf, size);
+}
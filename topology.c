@@ -0,0 +1,161 @@
+/*
+ * topology.c	- cpu lists and cache sharing domains from sysfs.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every cache a cpu sees has a directory /sys/devices/system/cpu/cpuN/
+ * cache/indexM with its level, its type and the list of cpus sharing it,
+ * in the same "0-3,8" format as the cpu lists of the command lines, and
+ * cpuN/topology the package and core the cpu belongs to.
+ */
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "topology.h"
+
+#define SYSFS_CPU	"/sys/devices/system/cpu"
+
+int parse_cpus(const char *str, cpu_set_t *set)
+{
+	char *end;
+
+	CPU_ZERO(set);
+	while (*str) {
+		unsigned long lo = strtoul(str, &end, 10), hi = lo;
+
+		if (end == str)
+			return -1;
+		if (*end == '-')
+			hi = strtoul(end + 1, &end, 10);
+		if (hi < lo || hi >= CPU_SETSIZE)
+			return -1;
+		while (lo <= hi)
+			CPU_SET(lo++, set);
+		if (*end == ',')
+			end++;
+		else if (*end && *end != '\n')
+			return -1;
+		str = end;
+		if (*str == '\n')
+			break;
+	}
+	return 0;
+}
+
+void format_cpus(char *buf, size_t len, const cpu_set_t *set)
+{
+	size_t at = 0;
+	int lo, hi;
+
+	buf[0] = '\0';
+	for (lo = 0; lo < CPU_SETSIZE && at < len; lo = hi + 1) {
+		if (!CPU_ISSET(lo, set)) {
+			hi = lo;
+			continue;
+		}
+		for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set);
+		     hi++)
+			;
+		if (hi > lo)
+			at += snprintf(buf + at, len - at, "%s%d-%d",
+				       at ? "," : "", lo, hi);
+		else
+			at += snprintf(buf + at, len - at, "%s%d",
+				       at ? "," : "", lo);
+	}
+}
+
+/* First line of the sysfs file named by @fmt into @buf, -1 if unreadable. */
+static int sysfs_read(char *buf, size_t len, const char *fmt, ...)
+{
+	char path[256];
+	va_list ap;
+	FILE *fp;
+	int ret = -1;
+
+	va_start(ap, fmt);
+	vsnprintf(path, sizeof(path), fmt, ap);
+	va_end(ap);
+	if (!(fp = fopen(path, "r")))
+		return -1;
+	if (fgets(buf, len, fp))
+		ret = 0;
+	fclose(fp);
+	return ret;
+}
+
+int cache_domain(int cpu, unsigned level, cpu_set_t *set)
+{
+	const char *dir = SYSFS_CPU "/cpu%d/cache/index%d/%s";
+	char line[1024];
+	unsigned best = 0;
+	int idx;
+
+	for (idx = 0; !sysfs_read(line, sizeof(line), dir, cpu, idx, "level");
+	     idx++) {
+		unsigned l = atoi(line);
+		cpu_set_t shared;
+
+		if (level ? l != level : l <= best)
+			continue;
+		if (sysfs_read(line, sizeof(line), dir, cpu, idx, "type") ||
+		    !strncmp(line, "Instr", 5))
+			continue;
+		if (sysfs_read(line, sizeof(line), dir, cpu, idx,
+			       "shared_cpu_list") || parse_cpus(line, &shared))
+			continue;
+		*set = shared;
+		if (level)
+			return 0;
+		best = l;
+	}
+	return best ? 0 : -1;
+}
+
+void online_cpus(cpu_set_t *set)
+{
+	char line[1024];
+	long i, n;
+
+	if (!sysfs_read(line, sizeof(line), SYSFS_CPU "/online") &&
+	    !parse_cpus(line, set) && CPU_COUNT(set))
+		return;
+	/* No sysfs: assume the usual numbering, 0 to n - 1. */
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	CPU_ZERO(set);
+	for (i = 0; i < n && i < CPU_SETSIZE; i++)
+		CPU_SET(i, set);
+	if (!CPU_COUNT(set))
+		CPU_SET(0, set);
+}
+
+/* @what of cpuN/topology, such as "core_id", or -1. */
+static int read_topology(int cpu, const char *what)
+{
+	char line[64];
+
+	if (sysfs_read(line, sizeof(line), SYSFS_CPU "/cpu%d/topology/%s", cpu,
+		       what))
+		return -1;
+	return atoi(line);
+}
+
+int core_peer(int cpu, bool same)
+{
+	int core = read_topology(cpu, "core_id");
+	int pkg = read_topology(cpu, "physical_package_id");
+	cpu_set_t online;
+	int i;
+
+	online_cpus(&online);
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (i != cpu && CPU_ISSET(i, &online) &&
+		    read_topology(i, "physical_package_id") == pkg &&
+		    (read_topology(i, "core_id") == core) == same)
+			return i;
+	return -1;
+}
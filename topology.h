@@ -0,0 +1,38 @@
+/*
+ * topology.h	- cpu lists and cache sharing domains, as sysfs describes
+ * 		  them.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Parse a cpu list such as "0-3,8" into @set, -1 if it is malformed. */
+int parse_cpus(const char *str, cpu_set_t *set);
+
+/*
+ * Online cpus into @set, from sysfs as the affinity of a pinned process
+ * says nothing about the others. Cpu numbers may have holes.
+ */
+void online_cpus(cpu_set_t *set);
+
+/* Print @set into @buf as a cpu list such as "0-3,8". */
+void format_cpus(char *buf, size_t len, const cpu_set_t *set);
+
+/*
+ * Cpus sharing the data or unified cache at @level with @cpu, or the last
+ * level cache if @level is 0. Returns -1 if sysfs does not describe it.
+ */
+int cache_domain(int cpu, unsigned level, cpu_set_t *set);
+
+/*
+ * An online cpu in the package of @cpu, on the same core (an SMT sibling)
+ * if @same, on another core otherwise. Returns -1 if there is none.
+ */
+int core_peer(int cpu, bool same);
+
+#endif /* TOPOLOGY_H */
@@ -0,0 +1,328 @@
+/*
+ * trace.c	- low-overhead load/store address trace capture.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * See trace.h for the file format. Every thread owns a single-producer,
+ * single-consumer byte ring: the thread publishes @head after each whole
+ * record, the writer thread copies [tail, head) out as one chunk and then
+ * publishes @tail. Neither side takes a lock on the fast path.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "trace.h"
+
+#define TRACE_RING_MASK		(TRACE_RING_SIZE - 1)
+/* Longest LEB128 encoding of a 64 bit value. */
+#define TRACE_MAX_RECORD	10
+
+struct trace_ring {
+	uint64_t head;			/* written by the traced thread */
+	uint64_t tail;			/* written by the writer thread */
+	uint64_t prev;
+	uint64_t records;
+	uint64_t stalls;
+	uint32_t tid;
+	uint8_t *data;
+	struct trace_ring *next;
+};
+
+bool trace_enabled;
+
+/*
+ * The ring of this thread and the trace_gen it belongs to. The gen is kept
+ * here and not in the ring: trace_close() frees every ring, and a thread
+ * other than the closing one still holds a pointer to its old one.
+ */
+static __thread struct trace_ring *ring;
+static __thread uint32_t ring_gen;
+static struct trace_ring *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer;
+static bool stopping;
+static uint32_t next_tid;
+/* Bumped by every trace_open(), so stale per-thread rings are dropped. */
+static uint32_t trace_gen;
+static int trace_fd = -1;
+static int write_error;
+
+int trace_thread_init(void)
+{
+	struct trace_ring *r;
+
+	if (ring && ring_gen == trace_gen)
+		return 0;
+	if (!(r = calloc(1, sizeof(*r))))
+		return -1;
+	r->data = mmap(NULL, TRACE_RING_SIZE, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (r->data == MAP_FAILED) {
+		free(r);
+		return -1;
+	}
+	pthread_mutex_lock(&rings_lock);
+	r->tid = next_tid++;
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_lock);
+	ring = r;
+	ring_gen = trace_gen;
+	return 0;
+}
+
+void trace_record(uintptr_t addr, bool write)
+{
+	struct trace_ring *r = ring;
+	uint64_t head, v;
+	int64_t delta;
+
+	if (!r || ring_gen != trace_gen) {
+		if (trace_thread_init())
+			return;
+		r = ring;
+	}
+	delta = (int64_t)(addr - r->prev);
+	r->prev = addr;
+	v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	v = (v << 1) | write;
+
+	head = r->head;
+	while (head + TRACE_MAX_RECORD -
+	       __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > TRACE_RING_SIZE) {
+		r->stalls++;
+		sched_yield();
+	}
+	do {
+		uint8_t b = v & 0x7f;
+
+		v >>= 7;
+		r->data[head++ & TRACE_RING_MASK] = b | (v ? 0x80 : 0);
+	} while (v);
+	r->records++;
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+}
+
+/* Write out what @r holds as one chunk, returns the bytes drained. */
+static size_t drain(struct trace_ring *r)
+{
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = r->tail;
+	uint32_t hdr[2];
+	struct iovec iov[3];
+	size_t len = head - tail, off = tail & TRACE_RING_MASK;
+	size_t first = len < TRACE_RING_SIZE - off ? len : TRACE_RING_SIZE - off;
+	int cnt = 2;
+	ssize_t ret;
+
+	if (!len)
+		return 0;
+	hdr[0] = r->tid;
+	hdr[1] = len;
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = r->data + off;
+	iov[1].iov_len = first;
+	if (first < len) {
+		iov[2].iov_base = r->data;
+		iov[2].iov_len = len - first;
+		cnt = 3;
+	}
+	/* Regular files do not return short writes short of ENOSPC. */
+	ret = writev(trace_fd, iov, cnt);
+	if (ret != (ssize_t)(sizeof(hdr) + len))
+		write_error = ret < 0 ? errno : ENOSPC;
+	__atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+	return len;
+}
+
+static size_t drain_all(void)
+{
+	struct trace_ring *r;
+	size_t n = 0;
+
+	pthread_mutex_lock(&rings_lock);
+	for (r = rings; r; r = r->next)
+		n += drain(r);
+	pthread_mutex_unlock(&rings_lock);
+	return n;
+}
+
+static void *writer_thread(void *arg __attribute__((__unused__)))
+{
+	const struct timespec idle = { 0, 100000 };
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+		if (!drain_all())
+			nanosleep(&idle, NULL);
+	drain_all();
+	return NULL;
+}
+
+/*
+ * Start the writer SCHED_OTHER and on the cpus the caller is not pinned to:
+ * the traced threads may be SCHED_FIFO on their cpu, where it would only run
+ * once they stall on a full ring. With nowhere else to go it shares theirs.
+ */
+static int writer_start(void)
+{
+	struct sched_param param = { 0 };
+	pthread_attr_t attr;
+	cpu_set_t traced, set;
+	long cpu, ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	int err;
+
+	CPU_ZERO(&set);
+	if (!sched_getaffinity(0, sizeof(traced), &traced))
+		for (cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; cpu++)
+			if (!CPU_ISSET(cpu, &traced))
+				CPU_SET(cpu, &set);
+	pthread_attr_init(&attr);
+	if (CPU_COUNT(&set))
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	err = pthread_create(&writer, &attr, writer_thread, NULL);
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+int trace_open(const char *path)
+{
+	int err;
+
+	if (trace_fd != -1) {
+		errno = EBUSY;
+		return -1;
+	}
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_fd == -1)
+		return -1;
+	if (write(trace_fd, TRACE_MAGIC, TRACE_MAGIC_LEN) != TRACE_MAGIC_LEN)
+		goto err;
+	trace_gen++;
+	next_tid = 0;
+	write_error = 0;
+	stopping = false;
+	if ((err = writer_start())) {
+		errno = err;
+		goto err;
+	}
+	__atomic_store_n(&trace_enabled, true, __ATOMIC_RELEASE);
+	return 0;
+err:
+	err = errno;
+	close(trace_fd);
+	trace_fd = -1;
+	errno = err;
+	return -1;
+}
+
+long long trace_close(void)
+{
+	struct trace_ring *r, *next;
+	long long records = 0;
+
+	if (trace_fd == -1)
+		return 0;
+	__atomic_store_n(&trace_enabled, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	pthread_mutex_lock(&rings_lock);
+	for (r = rings; r; r = next) {
+		next = r->next;
+		records += r->records;
+		munmap(r->data, TRACE_RING_SIZE);
+		free(r);
+	}
+	rings = NULL;
+	pthread_mutex_unlock(&rings_lock);
+	ring = NULL;
+
+	if (close(trace_fd) && !write_error)
+		write_error = errno;
+	trace_fd = -1;
+	if (write_error) {
+		errno = write_error;
+		return -1;
+	}
+	return records;
+}
+
+bool trace_probe(FILE *fp)
+{
+	char magic[TRACE_MAGIC_LEN];
+	int c = getc(fp);
+
+	if (c == EOF)
+		return false;
+	ungetc(c, fp);
+	if (c != TRACE_MAGIC[0])
+		return false;
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic))
+		return false;
+	return !memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+}
+
+void trace_reader_init(struct trace_reader *r, FILE *fp)
+{
+	memset(r, 0, sizeof(*r));
+	r->fp = fp;
+}
+
+int trace_next(struct trace_reader *r, uint64_t *addr, bool *write,
+	       uint32_t *tid)
+{
+	unsigned shift = 0;
+	uint64_t v = 0, *prev = NULL;
+	int64_t delta;
+	int c, i;
+
+	while (!r->left) {
+		uint32_t hdr[2];
+		size_t n = fread(hdr, sizeof(hdr[0]), 2, r->fp);
+
+		if (!n && feof(r->fp))
+			return 0;
+		if (n != 2)
+			return -1;
+		r->tid = hdr[0];
+		r->left = hdr[1];
+	}
+	do {
+		if (!r->left-- || shift > 63 || (c = getc_unlocked(r->fp)) == EOF)
+			return -1;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	for (i = 0; i < r->nthreads; i++)
+		if (r->state[i].tid == r->tid)
+			prev = &r->state[i].prev;
+	if (!prev) {
+		if (r->nthreads == sizeof(r->state) / sizeof(r->state[0]))
+			return -1;
+		r->state[r->nthreads].tid = r->tid;
+		r->state[r->nthreads].prev = 0;
+		prev = &r->state[r->nthreads++].prev;
+	}
+
+	*write = v & 1;
+	v >>= 1;
+	delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+	*prev += delta;
+	*addr = *prev;
+	*tid = r->tid;
+	return 1;
+}
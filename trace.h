@@ -0,0 +1,99 @@
+/*
+ * trace.h	- low-overhead load/store address trace capture.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Instrumented code calls TRACE_LOAD()/TRACE_STORE() on the addresses it
+ * touches. Each thread appends delta encoded records to its own preallocated
+ * ring buffer, and a writer thread drains the rings into the trace file in
+ * chunks, so the traced thread never blocks on I/O unless its ring fills up.
+ *
+ * The macros compile to nothing unless CONFIG_TRACE is defined, so the same
+ * kernel source can be built with and without instrumentation.
+ *
+ * File format (little endian):
+ *	header:	"LCTRACE1"
+ *	chunk:	u32 thread id, u32 length, @length bytes of records
+ *
+ * A record is one LEB128 varint holding (zigzag(addr - prev) << 1) | write,
+ * where @prev is the previous address recorded by the same thread (0 at
+ * start). Addresses must fit in 62 bits, which user space ones do. Chunks
+ * only ever hold whole records.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_MAGIC		"LCTRACE1"
+#define TRACE_MAGIC_LEN		8
+/* Per-thread ring size in bytes, a power of 2. */
+#define TRACE_RING_SIZE		(1U << 22)
+
+extern bool trace_enabled;
+
+void trace_record(uintptr_t addr, bool write);
+
+#ifdef CONFIG_TRACE
+#define TRACE_LOAD(p)							\
+	do {								\
+		if (__builtin_expect(trace_enabled, 0))			\
+			trace_record((uintptr_t)(p), false);		\
+	} while (0)
+#define TRACE_STORE(p)							\
+	do {								\
+		if (__builtin_expect(trace_enabled, 0))			\
+			trace_record((uintptr_t)(p), true);		\
+	} while (0)
+#else
+#define TRACE_LOAD(p)	do { } while (0)
+#define TRACE_STORE(p)	do { } while (0)
+#endif
+
+/*
+ * Create @path, start the writer thread and enable recording. The writer is
+ * SCHED_OTHER, on the cpus the caller is not pinned to. Returns 0 or -1 with
+ * errno set.
+ */
+int trace_open(const char *path);
+
+/*
+ * Stop recording, drain every ring, close the file and release the buffers.
+ * Instrumented threads must be done recording by then. Returns the number of
+ * records written, or -1 on a write error.
+ */
+long long trace_close(void);
+
+/*
+ * Allocate and fault in the calling thread's ring ahead of time, so the
+ * first recorded access does not pay for it. Returns 0 or -1.
+ */
+int trace_thread_init(void);
+
+struct trace_reader {
+	FILE *fp;
+	uint32_t tid;
+	uint32_t left;			/* bytes left in the current chunk */
+	int nthreads;
+	struct {
+		uint32_t tid;
+		uint64_t prev;
+	} state[64];
+};
+
+/* Returns true if the next bytes of @fp hold a trace header (consumed). */
+bool trace_probe(FILE *fp);
+
+/* Set up @r to decode @fp, positioned after the header. */
+void trace_reader_init(struct trace_reader *r, FILE *fp);
+
+/*
+ * Decode the next record. Returns 1 with @addr/@write/@tid filled in, 0 at
+ * end of file or -1 on a malformed trace.
+ */
+int trace_next(struct trace_reader *r, uint64_t *addr, bool *write,
+	       uint32_t *tid);
+
+#endif /* TRACE_H */
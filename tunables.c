@@ -0,0 +1,213 @@
+/*
+ * tunables.c	- GLIBC_TUNABLES for the string functions of this host, from
+ * 		  the enumerated caches and the measured crossovers, and a
+ * 		  before/after run of libc memcpy/memset proving them.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * glibc sizes its copy strategies from CPUID leaf 04H at startup: the L1D
+ * size is the data cache size, the L3 (or L2) size divided by the threads
+ * sharing it is the shared cache size, the non-temporal threshold is 3/4 of
+ * the latter and rep movsb/stosb start at 2 KB (times the vector size over
+ * 16). Under a hypervisor the leaf often describes the whole host LLC, or
+ * nothing useful, so the thresholds are taken from memops.c instead.
+ *
+ * The proof runs the libc benchmark in child processes, without
+ * GLIBC_TUNABLES and with the string printed here, since tunables are only
+ * read when a process starts. The runs alternate and the best rate of each
+ * is kept, so drift over the run does not favour either. The values glibc
+ * picked by itself can be listed with "ld.so --list-tunables".
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "memops.h"
+
+#define TUNABLES_LEN	512
+#define TUNABLES_SIZES	32
+#define TUNABLES_ROUNDS	3	/* default and tuned runs, interleaved */
+
+/* Bounds glibc enforces, values outside are ignored. */
+#define MIN_NON_TEMPORAL	0x4040
+#define MIN_REP_MOVSB		0x200
+#define MAX_THRESHOLD		(SIZE_MAX >> 4)	/* non-temporal, the lowest */
+
+extern char **environ;
+
+struct libc_rates {
+	int n;
+	size_t size[TUNABLES_SIZES];
+	double copy[TUNABLES_SIZES], set[TUNABLES_SIZES];
+};
+
+/* Append "glibc.cpu.@name=@value" to @buf, unless @value is 0. */
+static void add(char *buf, const char *name, size_t value)
+{
+	size_t len = strlen(buf);
+
+	if (!value)
+		return;
+	snprintf(buf + len, TUNABLES_LEN - len, "%sglibc.cpu.%s=%zu",
+		 len ? ":" : "", name, value);
+}
+
+/*
+ * Bring the crossover of @what into the bounds glibc accepts for tunable
+ * @name, and say so. A strategy that never won is disabled with the largest
+ * threshold glibc takes: leaving the tunable out would keep glibc's own
+ * guess from leaf 04H.
+ */
+static void bound(const char *name, const char *what, size_t *value,
+		  size_t min)
+{
+	if (*value == MEMOPS_NEVER) {
+		*value = MAX_THRESHOLD;
+		fprintf(stdout, " %s: %s never won up to 1 GB, disabled\n",
+			name, what);
+	} else if (*value && *value < min) {
+		fprintf(stdout, " %s: %zu raised to the glibc minimum %zu\n",
+			name, *value, min);
+		*value = min;
+	}
+}
+
+/* The value of GLIBC_TUNABLES for this host, in @buf. */
+static void tunables(char *buf)
+{
+	struct cache_info ci[CACHE_MAX_DESC];
+	const struct cache_info *l1, *llc;
+	struct memops_thresholds t;
+	size_t shared = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int n;
+
+	n = cache_enumerate(ci, CACHE_MAX_DESC);
+	l1 = cache_data_level(ci, n, 1);
+	if (!(llc = cache_data_level(ci, n, 3)))
+		llc = cache_data_level(ci, n, 2);
+	if (llc) {
+		unsigned threads = llc->sharing;
+
+		if (cpus > 0 && threads > cpus)
+			threads = cpus;
+		shared = llc->size / (threads ? threads : 1);
+	}
+
+	memops_thresholds(&t, GIGABYTES(1), NULL);
+	bound("x86_non_temporal_threshold", "streaming stores",
+	      &t.non_temporal, MIN_NON_TEMPORAL);
+	bound("x86_rep_movsb_threshold", "rep movsb", &t.rep_movsb,
+	      MIN_REP_MOVSB);
+	bound("x86_rep_stosb_threshold", "rep stosb", &t.rep_stosb, 1);
+
+	buf[0] = '\0';
+	add(buf, "x86_data_cache_size", l1 ? l1->size : 0);
+	add(buf, "x86_shared_cache_size", shared);
+	add(buf, "x86_non_temporal_threshold", t.non_temporal);
+	add(buf, "x86_rep_movsb_threshold", t.rep_movsb);
+	add(buf, "x86_rep_stosb_threshold", t.rep_stosb);
+}
+
+/*
+ * Run "@self libc" with GLIBC_TUNABLES set to @value (removed when NULL) and
+ * keep the best rates of its table and the ones already in @r. A run that
+ * fails leaves @r as it was: it is one sample less, not a reset.
+ */
+static void run_libc(const char *self, const char *value, struct libc_rates *r)
+{
+	char line[256], *env[256], tun[TUNABLES_LEN + 32];
+	struct libc_rates run = { 0 };
+	int fd[2], i, k = 0, status;
+	FILE *fp;
+	pid_t pid;
+
+	for (i = 0; environ[i] && k < 254; i++)
+		if (strncmp(environ[i], "GLIBC_TUNABLES=", 15))
+			env[k++] = environ[i];
+	if (value) {
+		snprintf(tun, sizeof(tun), "GLIBC_TUNABLES=%s", value);
+		env[k++] = tun;
+	}
+	env[k] = NULL;
+
+	if (pipe(fd))
+		die("pipe()");
+	fflush(stdout);
+	if ((pid = fork()) < 0)
+		die("fork()");
+	if (!pid) {
+		char *argv[] = { (char *)self, "libc", NULL };
+
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[0]);
+		close(fd[1]);
+		execve("/proc/self/exe", argv, env);
+		_exit(127);
+	}
+	close(fd[1]);
+	if (!(fp = fdopen(fd[0], "r")))
+		die("fdopen()");
+	while (fgets(line, sizeof(line), fp) && run.n < TUNABLES_SIZES)
+		if (sscanf(line, "%zu %lf %lf", &run.size[run.n],
+			   &run.copy[run.n], &run.set[run.n]) == 3)
+			run.n++;
+	fclose(fp);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return;
+	for (i = 0; i < run.n; i++) {
+		r->size[i] = run.size[i];
+		if (i >= r->n || run.copy[i] > r->copy[i])
+			r->copy[i] = run.copy[i];
+		if (i >= r->n || run.set[i] > r->set[i])
+			r->set[i] = run.set[i];
+	}
+	if (run.n > r->n)
+		r->n = run.n;
+}
+
+void tunables_benchmark(void)
+{
+	static struct libc_rates before, after;
+	char buf[TUNABLES_LEN], self[64];
+	double gain_copy = 0, gain_set = 0;
+	int i, n;
+
+	fprintf(stdout, "\nGLIBC_TUNABLES from measured crossovers\n");
+	tunables(buf);
+	fprintf(stdout, " GLIBC_TUNABLES=%s\n", buf);
+
+	/* argv[0] of the child only, it is exec'ed through /proc/self/exe. */
+	snprintf(self, sizeof(self), "benchmark");
+	for (i = 0; i < TUNABLES_ROUNDS; i++) {
+		run_libc(self, NULL, &before);
+		run_libc(self, buf, &after);
+	}
+	n = before.n < after.n ? before.n : after.n;
+	if (!n) {
+		fprintf(stdout, " Could not run libc benchmark in a child\n");
+		return;
+	}
+	fprintf(stdout, "\n libc GB/s, default -> tuned\n"
+		"       Bytes          memcpy                  memset\n");
+	for (i = 0; i < n; i++) {
+		double c = after.copy[i] / before.copy[i];
+		double s = after.set[i] / before.set[i];
+
+		fprintf(stdout, " %11zu %7.2f -> %7.2f %+4.0f%%  %7.2f -> %7.2f "
+			"%+4.0f%%\n", before.size[i], before.copy[i],
+			after.copy[i], 100 * (c - 1), before.set[i],
+			after.set[i], 100 * (s - 1));
+		gain_copy += c;
+		gain_set += s;
+	}
+	fprintf(stdout, " Mean change: memcpy %+.1f%%, memset %+.1f%%\n",
+		100 * (gain_copy / n - 1), 100 * (gain_set / n - 1));
+}
@@ -0,0 +1,342 @@
+/*
+ * tune.c	- recommended runtime settings for this host, each with the
+ * 		  measurements behind it, as a config file on stdout.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ *
+ * Every setting is a "key = value" line preceded by "#" comment lines with
+ * the data it was derived from, so "./benchmark tune > host.conf" keeps the
+ * justification with the value:
+ *
+ * workers.order: cpus in the order workers should be pinned, one per L2
+ *	domain (core) of every LLC domain first, SMT siblings last, from the
+ *	sysfs cache topology.
+ * workers.llc_domains: cpus of each LLC domain, ';' separated.
+ * tile.l1, tile.l2: working set per worker that stays in L1D / L2, half
+ *	the level if its chase latency is within 25% of the latency well
+ *	inside the level, else a quarter if that is, else that inner size.
+ * hash.group_bytes: slots probed together in a hash table, 128 when the
+ *	second line of a 128 byte pair comes at less than 25% extra, else
+ *	one line.
+ * prefetch.distance: elements ahead to software prefetch in a random
+ *	gather, the smallest distance within 5% of the best.
+ * copy.non_temporal_bytes: size from which streaming stores win, see
+ *	memops.c, or "none" when they never won up to the largest size timed
+ *	or could not be timed.
+ * memory.huge_pages: "thp" when transparent huge pages cut random access
+ *	time by 10% or more over 4 KB pages, else "none".
+ *
+ * Latencies are of a random pointer chase (chase.c); sizes are from leaf
+ * 04H.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "cacheinfo.h"
+#include "chase.h"
+#include "memops.h"
+#include "topology.h"
+#include "util.h"
+
+#define TUNE_STEPS	(1 << 20)	/* chase links per latency */
+#define TUNE_MAX	MEGABYTES(512)	/* largest buffer */
+#define TUNE_GATHER	(1 << 22)	/* elements per prefetch run */
+#define TUNE_TRIES	3
+#define TUNE_MAX_CPUS	1024
+
+static const unsigned tune_distances[] = { 0, 1, 2, 4, 8, 16, 32, 64, 128 };
+#define TUNE_NDISTANCES	\
+	(sizeof(tune_distances) / sizeof(tune_distances[0]))
+
+static unsigned seed = 0x7e5;
+
+static void *map(size_t size, int advice)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		die("mmap()");
+	if (advice >= 0)
+		madvise(p, size, advice);
+	memset(p, 1, size);
+	return p;
+}
+
+/* Chase latency in ns over @size bytes of @buf. */
+static double latency(void *buf, size_t size)
+{
+	void **p = chase_build(buf, size, 64, &seed);
+
+	if (!p)
+		die("chase_build()");
+	return chase_latency_ns(p, size / 64, TUNE_STEPS);
+}
+
+/* First cpu of the @level data/unified cache @cpu is in and its list. */
+static int domain_of(int cpu, unsigned level, char *list, size_t len)
+{
+	cpu_set_t set;
+	int first;
+
+	if (cache_domain(cpu, level, &set) || !CPU_COUNT(&set))
+		return -1;
+	format_cpus(list, len, &set);
+	for (first = 0; !CPU_ISSET(first, &set); first++)
+		;
+	return first;
+}
+
+static void workers(void)
+{
+	static int l2[TUNE_MAX_CPUS], l3[TUNE_MAX_CPUS], rank[TUNE_MAX_CPUS];
+	char list[1024], llcs[4096] = "", order[4096] = "";
+	int cpus[TUNE_MAX_CPUS], n = 0, i, j, r, max_rank = 0;
+	cpu_set_t online;
+
+	/* benchmark pins itself to cpu 0, the whole machine is wanted here. */
+	online_cpus(&online);
+
+	fprintf(stdout, "\n# Cache domains (sysfs), cpu: L2 domain, "
+		"LLC domain\n");
+	for (i = 0; i < TUNE_MAX_CPUS; i++) {
+		if (!CPU_ISSET(i, &online))
+			continue;
+		l2[n] = domain_of(i, 2, list, sizeof(list));
+		l3[n] = domain_of(i, 3, list, sizeof(list));
+		if (l3[n] < 0)
+			l3[n] = l2[n];
+		if (l3[n] == i) {
+			size_t len = strlen(llcs);
+
+			snprintf(llcs + len, sizeof(llcs) - len, "%s%s",
+				 len ? ";" : "", list);
+		}
+		/* How many cpus of the same L2 domain come before this one. */
+		for (rank[n] = 0, j = 0; j < n; j++)
+			if (l2[j] == l2[n])
+				rank[n]++;
+		if (rank[n] > max_rank)
+			max_rank = rank[n];
+		fprintf(stdout, "#   cpu%d: %d, %d\n", i, l2[n], l3[n]);
+		cpus[n++] = i;
+	}
+	/* First cpu of every core, LLC domain after LLC domain, then SMT. */
+	for (r = 0; r <= max_rank; r++) {
+		int done[TUNE_MAX_CPUS] = { 0 };
+
+		for (i = 0; i < n; i++) {
+			if (done[i] || rank[i] != r)
+				continue;
+			for (j = i; j < n; j++) {
+				size_t len = strlen(order);
+
+				if (done[j] || rank[j] != r || l3[j] != l3[i])
+					continue;
+				done[j] = 1;
+				snprintf(order + len, sizeof(order) - len,
+					 "%s%d", len ? "," : "", cpus[j]);
+			}
+		}
+	}
+	fprintf(stdout, "workers.order = %s\n", order);
+	fprintf(stdout, "workers.llc_domains = %s\n", llcs[0] ? llcs : order);
+}
+
+/*
+ * Half of the level, or a quarter, whichever is the largest whose latency
+ * is within 25% of @ref, the latency at @ref_size well inside the level;
+ * @ref_size itself when neither is.
+ */
+static size_t tile(unsigned level, size_t size, size_t ref_size, uint8_t *buf)
+{
+	double ref = latency(buf, ref_size), half, quarter;
+
+	half = latency(buf, size / 2);
+	quarter = latency(buf, size / 4);
+	fprintf(stdout, "\n# L%u %zu KB: chase %.2f ns at %zu KB, %.2f ns at "
+		"1/4, %.2f ns at 1/2, %.2f ns at the full size\n", level,
+		size >> 10, ref, ref_size >> 10, quarter, half,
+		latency(buf, size));
+	if (half <= 1.25 * ref)
+		return size / 2;
+	if (quarter <= 1.25 * ref)
+		return size / 4;
+	return ref_size;
+}
+
+/*
+ * Random lines of a buffer much larger than the LLC, touching one line
+ * or both lines of its 128 byte pair: ns per visit.
+ */
+static double pair_cost(uint8_t *buf, size_t size, bool both)
+{
+	size_t n = size / 128, i, k;
+	double best = 0;
+	int t;
+
+	for (t = 0; t < TUNE_TRIES; t++) {
+		uint64_t sum = 0;
+		double t0 = now_ns(), ns;
+		unsigned s = seed + t;
+
+		for (k = 0; k < TUNE_GATHER / 16; k++) {
+			i = (((size_t)rand_r(&s) << 31) | rand_r(&s)) % n;
+			sum += *(volatile uint64_t *)(buf + i * 128);
+			if (both)
+				sum += *(volatile uint64_t *)(buf + i * 128 +
+							      64);
+		}
+		ns = (now_ns() - t0) / (TUNE_GATHER / 16);
+		asm volatile ("" :: "r"(sum));
+		if (!t || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+/* ns per element of a gather through random @idx, prefetching @d ahead. */
+static double gather(const uint64_t *a, const uint32_t *idx, size_t n,
+		     unsigned d)
+{
+	double best = 0;
+	int t;
+
+	for (t = 0; t < TUNE_TRIES; t++) {
+		uint64_t sum = 0;
+		double t0 = now_ns(), ns;
+		size_t i;
+
+		for (i = 0; i < n; i++) {
+			if (d && i + d < n)
+				__builtin_prefetch(&a[idx[i + d]]);
+			sum += a[idx[i]];
+		}
+		ns = (now_ns() - t0) / n;
+		asm volatile ("" :: "r"(sum));
+		if (!t || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+static void prefetch_distance(uint8_t *buf, size_t size)
+{
+	size_t elems = size / sizeof(uint64_t), i;
+	double ns[TUNE_NDISTANCES], best = 0;
+	unsigned k, pick = 0;
+	uint32_t *idx;
+
+	if (!(idx = malloc(TUNE_GATHER * sizeof(*idx))))
+		die("malloc()");
+	if (elems > UINT32_MAX)
+		elems = UINT32_MAX;
+	for (i = 0; i < TUNE_GATHER; i++)
+		idx[i] = (((size_t)rand_r(&seed) << 31) | rand_r(&seed)) %
+			 elems;
+	fprintf(stdout, "\n# Gather of %d random elements over %zu MB, ns per "
+		"element by prefetch distance:\n#  ", TUNE_GATHER, size >> 20);
+	for (k = 0; k < TUNE_NDISTANCES; k++) {
+		ns[k] = gather((const uint64_t *)buf, idx, TUNE_GATHER,
+			       tune_distances[k]);
+		if (!k || ns[k] < best)
+			best = ns[k];
+		fprintf(stdout, " %u: %.2f", tune_distances[k], ns[k]);
+	}
+	for (k = 0; k < TUNE_NDISTANCES; k++)
+		if (ns[k] <= 1.05 * best) {
+			pick = tune_distances[k];
+			break;
+		}
+	fprintf(stdout, "\nprefetch.distance = %u\n", pick);
+	free(idx);
+}
+
+static void huge_pages(size_t size)
+{
+	char thp[128] = "unknown";
+	double small, huge;
+	uint8_t *buf;
+	FILE *fp;
+
+	if ((fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r"))) {
+		if (fgets(thp, sizeof(thp), fp))
+			thp[strcspn(thp, "\n")] = '\0';
+		fclose(fp);
+	}
+	buf = map(size, MADV_NOHUGEPAGE);
+	small = latency(buf, size);
+	munmap(buf, size);
+	buf = map(size, MADV_HUGEPAGE);
+	huge = latency(buf, size);
+	munmap(buf, size);
+	fprintf(stdout, "\n# Chase over %zu MB: %.2f ns on 4 KB pages, %.2f ns "
+		"with MADV_HUGEPAGE (%+.0f%%), THP %s\n", size >> 20, small,
+		huge, 100 * (huge / small - 1), thp);
+	fprintf(stdout, "memory.huge_pages = %s\n",
+		huge <= 0.9 * small ? "thp" : "none");
+}
+
+void tune_benchmark(void)
+{
+	size_t l1 = cache_level_size(1), l2 = cache_level_size(2), llc, big;
+	struct memops_thresholds t;
+	char host[64] = "";
+	double one, two;
+	uint8_t *buf;
+
+	if (!(llc = cache_level_size(3)))
+		llc = l2;
+	big = 4 * llc < TUNE_MAX ? 4 * llc : TUNE_MAX;
+	if (big < MEGABYTES(64))
+		big = MEGABYTES(64);
+	gethostname(host, sizeof(host) - 1);
+	fprintf(stdout, "\n# Runtime settings for %s, from ./benchmark tune\n",
+		host);
+
+	workers();
+
+	buf = map(big, MADV_NOHUGEPAGE);
+	if (l1)
+		fprintf(stdout, "tile.l1 = %zu\n",
+			tile(1, l1, l1 / 8 > 4096 ? l1 / 8 : 4096, buf));
+	if (l2)
+		fprintf(stdout, "tile.l2 = %zu\n",
+			tile(2, l2, l1 ? 2 * l1 : l2 / 8, buf));
+
+	one = pair_cost(buf, big, false);
+	two = pair_cost(buf, big, true);
+	fprintf(stdout, "\n# Random visits over %zu MB: %.2f ns for one line, "
+		"%.2f ns for both lines of its 128 byte pair (%+.0f%%)\n",
+		big >> 20, one, two, 100 * (two / one - 1));
+	fprintf(stdout, "hash.group_bytes = %u\n",
+		two <= 1.25 * one ? 128 : cache_line_size());
+
+	prefetch_distance(buf, big);
+	munmap(buf, big);
+
+	memops_thresholds(&t, big, NULL);
+	if (t.non_temporal == MEMOPS_NEVER)
+		fprintf(stdout, "\n# Streaming stores beat no cached copy up to "
+			"%zu MB (L2 %zu KB, L3 %zu KB), never stream\n",
+			big >> 20, l2 >> 10, cache_level_size(3) >> 10);
+	else if (!t.non_temporal)
+		fprintf(stdout, "\n# Streaming stores not timed, no AVX2\n");
+	else
+		fprintf(stdout, "\n# Streaming stores beat every cached copy "
+			"from %zu bytes (L2 %zu KB, L3 %zu KB)\n",
+			t.non_temporal, l2 >> 10, cache_level_size(3) >> 10);
+	if (t.non_temporal && t.non_temporal != MEMOPS_NEVER)
+		fprintf(stdout, "copy.non_temporal_bytes = %zu\n",
+			t.non_temporal);
+	else
+		fprintf(stdout, "copy.non_temporal_bytes = none\n");
+
+	huge_pages(big);
+}
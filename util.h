@@ -0,0 +1,21 @@
+/*
+ * util.h	- small inline helpers shared by the benchmarks and the
+ * 		  standalone tools.
+ *
+ * Author: Sougata Santra (sougata.santra@gmail.com)
+ */
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <time.h>
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+static inline double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#endif /* UTIL_H */